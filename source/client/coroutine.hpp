@@ -0,0 +1,241 @@
+#pragma once
+// C++20 协程接口(可选): 用 C++20 编译并且有 <coroutine> 时才可用, 此时定义 TRRPC_COROUTINE
+// Task<T>   : 协程的返回类型, 调用时不执行, 被 co_await 时才开始执行, 执行完恢复等待它的协程
+// spawn     : 在普通函数中启动一个 Task<void>, 不等待它结束
+// syncWait  : 在普通线程中阻塞等待一个 Task 的结果(例如 main 函数中)
+// CallbackAwaiter : 把回调形式的异步操作包装成可以 co_await 的对象, 等待期间不占用线程
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#define TRRPC_COROUTINE 1
+#include "../common/message.hpp"
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <future>
+#include <optional>
+#include <stdexcept>
+
+namespace TrRpc
+{
+    namespace client
+    {
+        // 恢复协程的执行器: 把恢复协程的任务交给别的线程执行; 为空时在操作完成的线程(客户端的 loop 线程)中直接恢复
+        using ResumeExecutor = std::function<void(std::function<void()>)>;
+
+        // co_await RpcClient::callAsync 失败时抛出的异常
+        class RpcError : public std::runtime_error
+        {
+        public:
+            RpcError(RCode rcode, const std::string &method)
+                : std::runtime_error(method + ": " + errReason(rcode)), _rcode(rcode) {}
+            RCode rcode() const { return _rcode; }
+
+        private:
+            RCode _rcode;
+        };
+
+        template <typename T>
+        class Task;
+        // Task 的返回值: 有返回值 和 没有返回值(void) 两种
+        template <typename T>
+        class TaskResult
+        {
+        public:
+            void return_value(T value) { _value = std::move(value); }
+            T result() { return std::move(*_value); }
+
+        private:
+            std::optional<T> _value;
+        };
+        template <>
+        class TaskResult<void>
+        {
+        public:
+            void return_void() {}
+            void result() {}
+        };
+
+        template <typename T = void>
+        class Task
+        {
+        public:
+            struct promise_type : public TaskResult<T>
+            {
+                std::coroutine_handle<> continuation; // 等待这个 Task 的协程
+                std::exception_ptr error;
+                Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+                std::suspend_always initial_suspend() noexcept { return {}; }
+                // 执行完直接切换到等待它的协程(对称转移: 开启优化时编译为尾调用, 连续很多层 co_await 也不会栈溢出)
+                struct FinalAwaiter
+                {
+                    bool await_ready() noexcept { return false; }
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                    {
+                        auto continuation = h.promise().continuation;
+                        return continuation ? continuation : std::noop_coroutine();
+                    }
+                    void await_resume() noexcept {}
+                };
+                FinalAwaiter final_suspend() noexcept { return {}; }
+                void unhandled_exception() { error = std::current_exception(); }
+            };
+            Task(Task &&other) noexcept : _handle(other._handle) { other._handle = nullptr; }
+            Task &operator=(Task &&other) noexcept
+            {
+                std::swap(_handle, other._handle);
+                return *this;
+            }
+            Task(const Task &) = delete;
+            Task &operator=(const Task &) = delete;
+            ~Task()
+            {
+                if (_handle)
+                    _handle.destroy();
+            }
+            bool await_ready() const noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+            {
+                _handle.promise().continuation = caller;
+                return _handle;
+            }
+            T await_resume()
+            {
+                if (_handle.promise().error)
+                    std::rethrow_exception(_handle.promise().error);
+                return _handle.promise().result();
+            }
+
+        private:
+            explicit Task(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+            std::coroutine_handle<promise_type> _handle;
+        };
+
+        // 启动以后不再等待的协程: 执行完自己释放
+        struct DetachedTask
+        {
+            struct promise_type
+            {
+                DetachedTask get_return_object() { return {}; }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() {}
+                void unhandled_exception()
+                {
+                    try
+                    {
+                        throw;
+                    }
+                    catch (const std::exception &e)
+                    {
+                        ERR_LOG("协程抛出了未处理的异常: %s", e.what());
+                    }
+                    catch (...)
+                    {
+                        ERR_LOG("协程抛出了未处理的异常");
+                    }
+                }
+            };
+        };
+        inline DetachedTask runDetached(Task<void> task)
+        {
+            co_await task;
+        }
+        // 启动协程, 立即返回: 协程执行到第一个需要等待的地方就返回到调用者, 之后在操作完成的线程中继续执行
+        inline void spawn(Task<void> task)
+        {
+            runDetached(std::move(task));
+        }
+        // 阻塞当前线程直到协程执行完, 返回它的结果(协程抛出的异常在这里重新抛出)
+        // 不要在客户端的 loop 线程中调用: 协程需要 loop 线程收到响应才能继续
+        template <typename T>
+        T syncWait(Task<T> task)
+        {
+            std::promise<T> promise;
+            std::future<T> result = promise.get_future();
+            [](Task<T> task, std::promise<T> &promise) -> DetachedTask
+            {
+                try
+                {
+                    if constexpr (std::is_void<T>::value)
+                    {
+                        co_await task;
+                        promise.set_value();
+                    }
+                    else
+                        promise.set_value(co_await task);
+                }
+                catch (...)
+                {
+                    promise.set_exception(std::current_exception());
+                }
+            }(std::move(task), promise);
+            return result.get();
+        }
+
+        // 等待一个回调形式的异步操作: start(done) 发起操作, 操作完成时(在任意线程中)调用一次 done(结果)
+        // 协程在 executor 中恢复, executor 为空时在调用 done 的线程中直接恢复; start 返回之前就完成了的操作, 协程不挂起直接继续
+        // 操作一直没有完成(例如 连接断开后响应再也不会到达)时, 协程会一直挂起
+        template <typename R>
+        class CallbackAwaiter
+        {
+        public:
+            using Done = std::function<void(R)>;
+            using Starter = std::function<void(const Done &)>;
+            CallbackAwaiter(Starter start, ResumeExecutor executor)
+                : _start(std::move(start)), _executor(std::move(executor)) {}
+            CallbackAwaiter(const CallbackAwaiter &) = delete;
+            bool await_ready() const noexcept { return false; }
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                // done 和 await_suspend 中后执行到 _done.exchange 的一方负责继续执行协程, 先执行的一方之后不再访问这个对象
+                // 这样 done 在 start 中同步调用时不会递归地恢复协程(连续很多次同步完成的 co_await 也不会栈溢出)
+                Starter start = std::move(_start);
+                ResumeExecutor executor = std::move(_executor);
+                start([this, handle, executor](R result)
+                      {
+                          _result = std::move(result);
+                          if (_done.exchange(true) == false)
+                              return; // await_suspend 还没有返回, 由它返回 false 继续执行协程
+                          if (executor)
+                              executor([handle]()
+                                       { handle.resume(); });
+                          else
+                              handle.resume(); });
+                return _done.exchange(true) == false;
+            }
+            R await_resume() { return std::move(_result); }
+
+        protected:
+            Starter _start;
+            ResumeExecutor _executor;
+            R _result{};
+            std::atomic<bool> _done{false};
+        };
+
+        // Rpc 调用的结果
+        struct RpcResult
+        {
+            RCode rcode = RCode::RCODE_OK;
+            Json::Value result;
+        };
+        // co_await 得到调用结果, 失败时抛出 RpcError
+        class RpcAwaiter : public CallbackAwaiter<RpcResult>
+        {
+        public:
+            RpcAwaiter(const std::string &method, Starter start, ResumeExecutor executor)
+                : CallbackAwaiter<RpcResult>(std::move(start), std::move(executor)), _method(method) {}
+            Json::Value await_resume()
+            {
+                if (_result.rcode != RCode::RCODE_OK)
+                    throw RpcError(_result.rcode, _method);
+                return std::move(_result.result);
+            }
+
+        private:
+            std::string _method;
+        };
+        // 主题操作: co_await 得到服务端是否处理成功
+        using TopicAwaiter = CallbackAwaiter<bool>;
+    }
+}
+#endif
@@ -0,0 +1,137 @@
+#pragma once
+#include "../common/detail.hpp"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace TrRpc
+{
+    namespace client
+    {
+        // 执行器的统计信息
+        struct ExecutorStats
+        {
+            size_t pending = 0;     // 当前排队还没执行的任务数
+            size_t max_pending = 0; // 排队任务数的历史最大值
+            size_t keys = 0;        // 当前有任务在排队或正在执行的 key 的个数
+            uint64_t executed = 0;  // 已经执行完的任务数
+        };
+        // 按 key 保序的执行器: 同一个 key 的任务按提交顺序一个接一个执行, 不同 key 的任务在多个线程上并行执行
+        // 每个 key 有自己的队列(strand), 有任务时把 key 放进就绪队列, 由空闲的工作线程取出执行一个任务
+        // 执行完如果这个 key 还有任务, 就把它重新放到就绪队列的末尾(各个 key 轮流执行, 一个很忙的 key 不会饿死其它 key)
+        // 队列没有上限: 提交任务的是连接的 I/O 线程, 不能阻塞它; 积压情况通过 stats() / depth() 观察
+        class OrderedExecutor
+        {
+        public:
+            using ptr = std::shared_ptr<OrderedExecutor>;
+            using Task = std::function<void()>;
+            OrderedExecutor(size_t threads)
+                : _stop(false)
+            {
+                for (size_t i = 0; i < std::max((size_t)1, threads); i++)
+                    _workers.emplace_back(&OrderedExecutor::worker, this);
+            }
+            // 析构时执行完已经提交的任务再退出
+            ~OrderedExecutor()
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _stop = true;
+                }
+                _cond.notify_all();
+                for (auto &worker : _workers)
+                    worker.join();
+            }
+            void submit(const std::string &key, Task task)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    Strand &strand = _strands[key];
+                    strand.tasks.push_back(std::move(task));
+                    _stats.pending++;
+                    _stats.max_pending = std::max(_stats.max_pending, _stats.pending);
+                    if (strand.scheduled) // 已经在就绪队列中 或者 正在执行, 执行完会继续取
+                        return;
+                    strand.scheduled = true;
+                    _ready.push_back(key);
+                }
+                _cond.notify_one();
+            }
+            ExecutorStats stats()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                ExecutorStats stats = _stats;
+                stats.keys = _strands.size();
+                return stats;
+            }
+            // 某个 key 排队中的任务数
+            size_t depth(const std::string &key)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto it = _strands.find(key);
+                return it == _strands.end() ? 0 : it->second.tasks.size();
+            }
+
+        private:
+            struct Strand
+            {
+                std::deque<Task> tasks;
+                bool scheduled = false; // 在就绪队列中 或者 正在被某个线程执行
+            };
+            void worker()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                while (true)
+                {
+                    _cond.wait(lock, [this]()
+                               { return _stop || !_ready.empty(); });
+                    if (_ready.empty()) // _stop 并且没有任务了
+                        return;
+                    std::string key = std::move(_ready.front());
+                    _ready.pop_front();
+                    auto it = _strands.find(key);
+                    Task task = std::move(it->second.tasks.front());
+                    it->second.tasks.pop_front();
+                    _stats.pending--;
+                    lock.unlock();
+                    try
+                    {
+                        task();
+                    }
+                    catch (const std::exception &e)
+                    {
+                        ERR_LOG("执行 %s 的任务时抛出异常: %s", key.c_str(), e.what());
+                    }
+                    catch (...)
+                    {
+                        ERR_LOG("执行 %s 的任务时抛出未知异常", key.c_str());
+                    }
+                    lock.lock();
+                    _stats.executed++;
+                    // 执行期间 _strands 可能插入了别的 key, 重新查找
+                    it = _strands.find(key);
+                    if (it->second.tasks.empty())
+                        _strands.erase(it); // 没有任务了: 不保留空队列, 主题再多也不会一直占内存
+                    else
+                    {
+                        _ready.push_back(key);
+                        _cond.notify_one();
+                    }
+                }
+            }
+
+        private:
+            std::mutex _mutex;
+            std::condition_variable _cond;
+            bool _stop;
+            std::unordered_map<std::string, Strand> _strands;
+            std::deque<std::string> _ready; // 有任务等待执行的 key
+            ExecutorStats _stats;
+            std::vector<std::thread> _workers;
+        };
+    }
+}
@@ -0,0 +1,272 @@
+#pragma once
+#include "../common/fields.hpp"
+#include "../common/detail.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// 可以组合的 future: 和 std::future 一样可以阻塞 get(), 另外可以用 then / whenAll / whenAny 挂上后续处理
+// 后续处理在完成 future 的线程中(收到响应的客户端 loop 线程)直接执行, 不需要另外的线程等待
+// 完成时只唤醒等待的线程、调用唯一的一个后续处理: 一个 future 只能 get 或者 then 一次(和 std::future 相同)
+// 结果是 值 或者 错误码(RCode), 出错时 get() 抛出 FutureError, then 的处理函数不会被调用, 错误码直接传给 then 返回的 future
+// then 的处理函数抛出异常时记录日志, then 返回的 future 以 RCODE_INTERNAL_ERROR 完成(异常不会传到完成 future 的 loop 线程)
+// 分配: rpc 调用的 future 由 Requestor 直接完成, 只分配一次共享状态;
+// 但是 then / whenAll / whenAny 每次都要为新的 future 分配一个状态, 后续处理放在 std::function 里(捕获较多时还会再分配一次)
+namespace TrRpc
+{
+    namespace client
+    {
+        class FutureError : public std::runtime_error
+        {
+        public:
+            FutureError(RCode rcode)
+                : std::runtime_error(errReason(rcode)), _rcode(rcode) {}
+            RCode rcode() const { return _rcode; }
+
+        private:
+            RCode _rcode;
+        };
+
+        template <typename T>
+        class Future;
+        template <typename T>
+        class Promise;
+
+        // Promise 和 Future 共享的状态: 一次分配, 里面放结果、等待用的条件变量 和 后续处理
+        template <typename T>
+        class FutureState
+        {
+        public:
+            using ptr = std::shared_ptr<FutureState<T>>;
+            using Callback = std::function<void(RCode rcode, T &value)>;
+            FutureState() : _ready(false), _rcode(RCode::RCODE_OK), _value() {}
+            // 设置结果: 只有第一次有效
+            void complete(RCode rcode, T value)
+            {
+                Callback cb;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if (_ready)
+                        return;
+                    _ready = true;
+                    _rcode = rcode;
+                    _value = std::move(value);
+                    cb = std::move(_callback);
+                }
+                _cond.notify_all();
+                if (cb)
+                    cb(_rcode, _value); // 已经完成, 之后不会再修改结果, 不需要加锁
+            }
+            // 设置后续处理: 已经完成时直接在当前线程中执行
+            void setCallback(Callback cb)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if (_ready == false)
+                    {
+                        _callback = std::move(cb);
+                        return;
+                    }
+                }
+                cb(_rcode, _value);
+            }
+            bool ready()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                return _ready;
+            }
+            void wait()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond.wait(lock, [this]()
+                           { return _ready; });
+            }
+            bool waitFor(int ms)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                return _cond.wait_for(lock, std::chrono::milliseconds(ms), [this]()
+                                      { return _ready; });
+            }
+            RCode rcode()
+            {
+                wait();
+                return _rcode;
+            }
+            T &value()
+            {
+                wait();
+                return _value;
+            }
+
+        private:
+            std::mutex _mutex;
+            std::condition_variable _cond;
+            bool _ready;
+            RCode _rcode;
+            T _value;
+            Callback _callback;
+        };
+
+        template <typename T>
+        class Promise
+        {
+        public:
+            Promise() : _state(std::make_shared<FutureState<T>>()) {}
+            Future<T> future() { return Future<T>(_state); }
+            void setValue(T value) const { _state->complete(RCode::RCODE_OK, std::move(value)); }
+            void setError(RCode rcode) const { _state->complete(rcode, T()); }
+            // 共享的状态: Requestor 保存它, 收到响应时直接完成
+            const typename FutureState<T>::ptr &state() const { return _state; }
+
+        private:
+            typename FutureState<T>::ptr _state;
+        };
+
+        template <typename T>
+        class Future
+        {
+        public:
+            Future() {}
+            explicit Future(const typename FutureState<T>::ptr &state) : _state(state) {}
+            Future(Future &&other) noexcept : _state(std::move(other._state)) {}
+            Future &operator=(Future &&other) noexcept
+            {
+                _state = std::move(other._state);
+                return *this;
+            }
+            Future(const Future &) = delete;
+            Future &operator=(const Future &) = delete;
+
+            bool valid() const { return _state != nullptr; }
+            bool ready() const { return _state->ready(); }
+            void wait() const { _state->wait(); }
+            // 等待 ms 毫秒, 完成了返回 true
+            bool waitFor(int ms) const { return _state->waitFor(ms); }
+            // 阻塞等待完成, 返回结果的错误码(不会抛出异常)
+            RCode rcode() const { return _state->rcode(); }
+            // 阻塞等待完成并取出结果, 出错时抛出 FutureError; 取出后 future 失效
+            T get()
+            {
+                auto state = std::move(_state);
+                if (state->rcode() != RCode::RCODE_OK)
+                    throw FutureError(state->rcode());
+                return std::move(state->value());
+            }
+            // 完成后调用 cb(错误码, 结果), 之后 future 失效
+            void onComplete(const std::function<void(RCode rcode, T &value)> &cb)
+            {
+                auto state = std::move(_state);
+                state->setCallback(cb);
+            }
+            // 成功时用 f(结果) 的返回值完成新的 future, 出错时把错误码传下去; f 不能返回 void(只需要处理结果时用 onComplete)
+            template <typename F>
+            Future<typename std::decay<typename std::result_of<F(T &)>::type>::type> then(F f)
+            {
+                using R = typename std::decay<typename std::result_of<F(T &)>::type>::type;
+                Promise<R> promise;
+                Future<R> next = promise.future();
+                onComplete([promise, f](RCode rcode, T &value) mutable
+                           {
+                               if (rcode != RCode::RCODE_OK)
+                                   return promise.setError(rcode);
+                               R result;
+                               try
+                               {
+                                   result = f(value);
+                               }
+                               catch (const std::exception &e)
+                               {
+                                   ERR_LOG("future 的后续处理抛出了异常: %s", e.what());
+                                   return promise.setError(RCode::RCODE_INTERNAL_ERROR);
+                               }
+                               catch (...)
+                               {
+                                   ERR_LOG("future 的后续处理抛出了未知异常");
+                                   return promise.setError(RCode::RCODE_INTERNAL_ERROR);
+                               }
+                               promise.setValue(std::move(result)); });
+                return next;
+            }
+
+        private:
+            typename FutureState<T>::ptr _state;
+        };
+
+        // 一个已经完成的 future
+        template <typename T>
+        Future<T> makeReadyFuture(T value)
+        {
+            Promise<T> promise;
+            promise.setValue(std::move(value));
+            return promise.future();
+        }
+
+        // 所有 future 都成功时按顺序得到全部结果; 有一个出错就以它的错误码完成(不再等其它的)
+        template <typename T>
+        Future<std::vector<T>> whenAll(std::vector<Future<T>> futures)
+        {
+            struct Context
+            {
+                std::mutex mutex;
+                size_t remaining;
+                std::vector<T> values;
+                Promise<std::vector<T>> promise;
+            };
+            auto ctx = std::make_shared<Context>();
+            ctx->remaining = futures.size();
+            ctx->values.resize(futures.size());
+            Future<std::vector<T>> result = ctx->promise.future();
+            if (futures.empty())
+                ctx->promise.setValue(std::vector<T>());
+            for (size_t i = 0; i < futures.size(); i++)
+            {
+                futures[i].onComplete([ctx, i](RCode rcode, T &value)
+                                      {
+                                          if (rcode != RCode::RCODE_OK)
+                                              return ctx->promise.setError(rcode);
+                                          std::unique_lock<std::mutex> lock(ctx->mutex);
+                                          ctx->values[i] = std::move(value);
+                                          if (--ctx->remaining > 0)
+                                              return;
+                                          lock.unlock();
+                                          ctx->promise.setValue(std::move(ctx->values)); });
+            }
+            return result;
+        }
+
+        // 第一个成功的 future 的 序号和结果(例如同时请求多个服务提供者, 用最快的响应); 全部出错时以最后一个错误码完成
+        template <typename T>
+        Future<std::pair<size_t, T>> whenAny(std::vector<Future<T>> futures)
+        {
+            struct Context
+            {
+                std::mutex mutex;
+                size_t remaining;
+                Promise<std::pair<size_t, T>> promise;
+            };
+            auto ctx = std::make_shared<Context>();
+            ctx->remaining = futures.size();
+            Future<std::pair<size_t, T>> result = ctx->promise.future();
+            if (futures.empty())
+                ctx->promise.setError(RCode::RCODE_INVALID_PARAMS);
+            for (size_t i = 0; i < futures.size(); i++)
+            {
+                futures[i].onComplete([ctx, i](RCode rcode, T &value)
+                                      {
+                                          if (rcode == RCode::RCODE_OK)
+                                              return ctx->promise.setValue(std::make_pair(i, std::move(value)));
+                                          std::unique_lock<std::mutex> lock(ctx->mutex);
+                                          if (--ctx->remaining > 0)
+                                              return;
+                                          lock.unlock();
+                                          ctx->promise.setError(rcode); });
+            }
+            return result;
+        }
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include "../common/net.hpp"
 #include "../common/message.hpp"
+#include "future.hpp"
 #include <unordered_map>
 #include <future>
 // 因为普通的send以后，响应到达的顺序是不一定的，不知道响应要交给谁，所以我们可以借助 ID (以下还添加获取响应的其他方式)
@@ -10,6 +11,7 @@
 // 1. 异步获取响应(返回 future, 以后自己get())
 // 2. 同步阻塞获取响应(发送请求后, 直到获取响应了才返回)
 // 3. 回调处理响应(无须主动获取，把响应传给回调去处理)
+// 另外 rpc 请求可以直接完成一个可以组合的 future(Promise): 不经过回调, 除了请求描述以外不需要额外分配
 
 namespace TrRpc
 {
@@ -27,10 +29,12 @@ namespace TrRpc
                 using ptr = std::shared_ptr<RequestDesc>;
 
                 BaseMessage::ptr request;
+                BaseConnection::ptr conn;                // 请求从哪个连接发出
                 RType rtype;                             // 标记请求规则
-                std::promise<BaseMessage::ptr> response; // 存放响应，后续通过 future 支持异步获取
+                std::unique_ptr<std::promise<BaseMessage::ptr>> response; // 存放响应，后续通过 future 支持异步获取(只有 REQ_ASYNC 才创建)
                 // 回调函数(给回调处理提供)
                 RequestCallback calllback;
+                FutureState<Json::Value>::ptr future; // REQ_FUTURE: 收到响应时用 rpc 结果完成
             };
             // 提供给底层 Connection 的回调设置: 收到响应后进行响应处理
             void onResponse(const BaseConnection::ptr &conn, BaseMessage::ptr &msg)
@@ -43,9 +47,11 @@ namespace TrRpc
                     return;
                 }
                 if (rdp->rtype == RType::REQ_ASYNC) // 根据请求处理规则，分发响应
-                    rdp->response.set_value(msg);
+                    rdp->response->set_value(msg);
                 else if (rdp->rtype == RType::REQ_CALLBACK && rdp->calllback)
                     rdp->calllback(msg);
+                else if (rdp->rtype == RType::REQ_FUTURE)
+                    completeFuture(rdp->future, msg);
                 else
                     ERR_LOG("请求处理规则未知");
                 delDescribe(rid); // 删除处理完的请求
@@ -54,14 +60,14 @@ namespace TrRpc
             // 发送请求，并且希望异步获取响应
             bool send(const BaseConnection::ptr &conn, const BaseMessage::ptr &req, AsyncResponse &async_rsp)
             {
-                RequestDesc::ptr rdp = newDescribe(req, RType::REQ_ASYNC);
+                RequestDesc::ptr rdp = newDescribe(conn, req, RType::REQ_ASYNC);
                 if (rdp.get() == nullptr)
                 {
                     ERR_LOG("构造请求对象失败");
                     return false;
                 }
                 conn->send(req);
-                async_rsp = rdp->response.get_future();
+                async_rsp = rdp->response->get_future();
                 return true;
             }
             // 同步获取响应
@@ -77,7 +83,7 @@ namespace TrRpc
             // 回调处理响应
             bool send(const BaseConnection::ptr &conn, const BaseMessage::ptr &req, RequestCallback &cb)
             {
-                RequestDesc::ptr rdp = newDescribe(req, RType::REQ_CALLBACK, cb);
+                RequestDesc::ptr rdp = newDescribe(conn, req, RType::REQ_CALLBACK, cb);
                 if (rdp.get() == nullptr)
                 {
                     ERR_LOG("构造请求对象失败");
@@ -86,14 +92,89 @@ namespace TrRpc
                 conn->send(req); // send 直接发出去，对面收到了调用 OnResponse 直接把响应回调处理了，我们无须关心获取响应
                 return true;
             }
+            // rpc 请求: 收到响应(或者连接失败)时在 I/O 线程中直接完成 promise 的 future, 后续处理也在那里执行
+            bool send(const BaseConnection::ptr &conn, const BaseMessage::ptr &req, const Promise<Json::Value> &promise)
+            {
+                RequestDesc::ptr rdp = newDescribe(conn, req, RType::REQ_FUTURE);
+                if (rdp.get() == nullptr)
+                {
+                    ERR_LOG("构造请求对象失败");
+                    return false;
+                }
+                rdp->future = promise.state();
+                conn->send(req);
+                return true;
+            }
+
+            // 连接失败(例如 连接一直建立不起来): 从 conn 发出、还在等待响应的请求都以错误码 rcode 结束
+            // 按请求的类型构造一个出错的响应交给 onResponse, 等待响应的 future / 回调 都会收到它
+            void failRequests(const BaseConnection::ptr &conn, RCode rcode)
+            {
+                std::vector<RequestDesc::ptr> descs;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    for (auto &it : _request_desc)
+                    {
+                        if (it.second->conn == conn)
+                            descs.push_back(it.second);
+                    }
+                }
+                for (auto &desc : descs)
+                {
+                    BaseMessage::ptr rsp = errorResponse(desc->request, rcode);
+                    if (rsp)
+                        onResponse(conn, rsp);
+                }
+            }
 
         private:
-            RequestDesc::ptr newDescribe(const BaseMessage::ptr &req, RType rt, const RequestCallback &cb = RequestCallback())
+            static void completeFuture(const FutureState<Json::Value>::ptr &state, const BaseMessage::ptr &msg)
+            {
+                auto rpc_rsp_msg = std::dynamic_pointer_cast<RpcResponse>(msg);
+                if (rpc_rsp_msg == nullptr)
+                {
+                    ERR_LOG("rpc响应, 向下类型转换失败");
+                    return state->complete(RCode::RCODE_INVALID_MSG, Json::Value());
+                }
+                if (rpc_rsp_msg->rcode() != RCode::RCODE_OK)
+                    return state->complete(rpc_rsp_msg->rcode(), Json::Value());
+                state->complete(RCode::RCODE_OK, rpc_rsp_msg->result());
+            }
+            static BaseMessage::ptr errorResponse(const BaseMessage::ptr &req, RCode rcode)
+            {
+                MType rsp_type;
+                switch (req->mtype())
+                {
+                case MType::REQ_RPC:
+                    rsp_type = MType::RSP_RPC;
+                    break;
+                case MType::REQ_TOPIC:
+                case MType::REQ_TOPIC_BINARY:
+                    rsp_type = MType::RSP_TOPIC;
+                    break;
+                case MType::REQ_SERVICE:
+                    rsp_type = MType::RSP_SERVICE;
+                    break;
+                default:
+                    return BaseMessage::ptr();
+                }
+                auto rsp = std::dynamic_pointer_cast<JsonResponse>(MessageFactory::create(rsp_type));
+                if (rsp.get() == nullptr)
+                    return BaseMessage::ptr();
+                rsp->setId(req->rid());
+                rsp->setMtype(rsp_type);
+                rsp->setRcode(rcode);
+                return rsp;
+            }
+            RequestDesc::ptr newDescribe(const BaseConnection::ptr &conn, const BaseMessage::ptr &req, RType rt, const RequestCallback &cb = RequestCallback())
             {
                 std::unique_lock<std::mutex> lock(_mutex);
                 RequestDesc::ptr desc = std::make_shared<RequestDesc>();
                 desc->request = req;
+                desc->conn = conn;
                 desc->rtype = rt;
+                if (rt == RType::REQ_ASYNC)
+                    desc->response.reset(new std::promise<BaseMessage::ptr>());
                 if (rt == RType::REQ_CALLBACK && cb)
                     desc->calllback = cb;
                 _request_desc.insert(std::make_pair(req->rid(), desc));
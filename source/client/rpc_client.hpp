@@ -4,6 +4,7 @@
 #include "rpc_registry.hpp"
 #include "../common/dispatcher.hpp"
 #include "rpc_topic.hpp"
+#include "coroutine.hpp"
 
 // 对 Rpc 业务客户端进行封装
 // 1. 服务注册客户端: 让服务提供者可以向服务中心进行注册服务
@@ -13,39 +14,256 @@ namespace TrRpc
 {
     namespace client
     {
+        // 释放换下来的客户端(调用者已加锁): 客户端销毁时要等它的 loop 线程退出, 不能在它自己的 loop 线程中销毁
+        // 只挪出 当前线程不是它的 loop 线程、并且没有别人持有(例如 连接超时处理中的局部变量) 的客户端, 其它的留到下一次
+        // 挪到 released 中, 由调用者在解锁之后销毁(销毁时要等 loop 线程执行完, 这个 loop 可能正在等同一把锁)
+        inline void releaseRetired(std::vector<BaseClient::ptr> &retired, std::vector<BaseClient::ptr> &released)
+        {
+            for (auto it = retired.begin(); it != retired.end();)
+            {
+                if (it->use_count() == 1 && (*it)->inLoopThread() == false)
+                {
+                    released.push_back(std::move(*it));
+                    it = retired.erase(it);
+                }
+                else
+                    ++it;
+            }
+        }
+
+        // 与注册中心(集群)的连接: 从节点列表中随机选一个节点连接，把客户端分散到各个节点上
+        // 连接断开后换到下一个节点，并调用切换回调让上层在新连接上恢复状态(重新注册 / 重新发现)
+        // 连接在 connectTimeout 秒内没有建立(节点没有启动)也换到下一个节点
+        class RegistryLink
+        {
+        public:
+            using ptr = std::shared_ptr<RegistryLink>;
+            using SwitchCallback = std::function<void(const BaseClient::ptr &)>;
+            using FailCallback = std::function<void(const BaseConnection::ptr &)>; // 换下来的连接: 上面还在等待响应的请求不会再有响应
+            RegistryLink(const std::vector<Address> &nodes, const MessageCallback &msg_cb)
+                : _nodes(nodes), _msg_cb(msg_cb), _shutdown(false), _heartbeat_interval(-1), _idle_timeout(-1)
+            {
+                std::random_device rd;
+                _idx = _nodes.empty() ? 0 : rd() % _nodes.size();
+            }
+            // 需要在 connect 之前设置
+            void setSwitchCallback(const SwitchCallback &cb)
+            {
+                _switch_cb = cb;
+            }
+            void setFailCallback(const FailCallback &cb)
+            {
+                _fail_cb = cb;
+            }
+            void connect()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                newClient();
+            }
+            BaseClient::ptr client()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                return _client;
+            }
+            // 心跳设置: 应用到当前的连接 和 以后切换到的连接
+            void setHeartbeat(int interval, int idle_timeout)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _heartbeat_interval = interval;
+                _idle_timeout = idle_timeout;
+                if (_client)
+                    _client->setHeartbeat(interval, idle_timeout);
+            }
+            void shutdown()
+            {
+                BaseClient::ptr client;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _shutdown = true;
+                    client = _client;
+                }
+                client->shutdown();
+            }
+
+        private:
+            // 调用者已加锁
+            void newClient()
+            {
+                const Address &node = _nodes[_idx % _nodes.size()];
+                auto client = ClientFactory::create(node.first, node.second);
+                BaseClient *raw = client.get();
+                client->SetMessageCallback(_msg_cb);
+                client->SetCloseCallback([this, raw](BaseConnection::ptr &)
+                                         { onClose(raw); });
+                if (_heartbeat_interval >= 0)
+                    client->setHeartbeat(_heartbeat_interval, _idle_timeout);
+                client->asyncConnect(); // 不阻塞，连接建立前的请求会被缓存
+                client->runAfter(connectTimeout, [this, raw]()
+                                 { onConnectTimeout(raw); });
+                _client = client;
+            }
+            // 运行在断开的那个客户端自己的 loop 线程中，不能在这里释放它，先挪到 _retired 中
+            // 已经关闭(shutdown)或者早已换下来的连接不会切换节点, 但是上面等待响应的请求同样要结束(重复结束没有影响)
+            void onClose(BaseClient *which)
+            {
+                switchNode(which, false);
+                if (_fail_cb)
+                    _fail_cb(which->connection());
+            }
+            // 连接超时(运行在该客户端自己的 loop 线程中): 还没有建立连接就换到下一个节点
+            void onConnectTimeout(BaseClient *which)
+            {
+                if (which->connected())
+                    return;
+                switchNode(which, true);
+            }
+            void switchNode(BaseClient *which, bool timeout)
+            {
+                std::vector<BaseClient::ptr> released; // 最后销毁: 在解锁之后
+                BaseClient::ptr old_client, client;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if (_shutdown || _client.get() != which)
+                        return;
+                    releaseRetired(_retired, released); // 更早换下来的客户端
+                    old_client = _client;
+                    _retired.push_back(_client);
+                    _idx++;
+                    newClient();
+                    client = _client;
+                    const Address &node = _nodes[_idx % _nodes.size()];
+                    INF_LOG("%s，切换到节点 %s:%d", timeout ? "连接注册中心超时" : "与注册中心的连接断开", node.first.c_str(), node.second);
+                }
+                if (timeout)
+                    old_client->shutdown(); // 停止 muduo 对这个节点的重试
+                if (_fail_cb)
+                    _fail_cb(old_client->connection());
+                if (_switch_cb)
+                    _switch_cb(client);
+            }
+
+        private:
+            std::mutex _mutex;
+            std::vector<Address> _nodes;
+            size_t _idx;
+            MessageCallback _msg_cb;
+            SwitchCallback _switch_cb;
+            FailCallback _fail_cb;
+            bool _shutdown;
+            BaseClient::ptr _client;
+            std::vector<BaseClient::ptr> _retired;
+            int _heartbeat_interval; // 小于 0 表示没有设置过, 使用客户端的默认值
+            int _idle_timeout;
+            static constexpr double connectTimeout = 3.0; // 连接一个节点的超时时间(秒)
+        };
+
         class RegistryClient
         {
         public:
             using ptr = std::shared_ptr<RegistryClient>;
+            using LoadSampler = std::function<LoadInfo()>;
             // 传入注册中心信息, 连接注册中心
             RegistryClient(const std::string &ip, int port)
+                : RegistryClient(std::vector<Address>{Address(ip, port)}) {}
+            // 注册中心集群: 连接其中一个节点，断开后切换到其它节点并重新注册
+            RegistryClient(const std::vector<Address> &nodes)
                 : _requestor(std::make_shared<Requestor>()),
                   _provider(std::make_shared<Provider>(_requestor)),
                   _dispatcher(std::make_shared<Dispatcher>())
             {
                 auto rsp_cb = std::bind(&Requestor::onResponse, _requestor.get(), std::placeholders::_1, std::placeholders::_2);
                 _dispatcher->registerHandler<BaseMessage>(MType::RSP_SERVICE, rsp_cb);
-                
-                _client = ClientFactory::create(ip, port);
+
                 auto msg_cb = std::bind(&Dispatcher::OnMessage, _dispatcher.get(), std::placeholders::_1, std::placeholders::_2);
-                _client->SetMessageCallback(msg_cb);
-                _client->connect();
+                _link = std::make_shared<RegistryLink>(nodes, msg_cb);
+                _link->setSwitchCallback(std::bind(&RegistryClient::onSwitch, this, std::placeholders::_1));
+                _link->setFailCallback([this](const BaseConnection::ptr &conn)
+                                       { _requestor->failRequests(conn, RCode::RCODE_DISCONNECTED); });
+                _link->connect();
+            }
+            // 心跳间隔 和 空闲超时(秒), 0 表示关闭; 默认 10 秒 / 30 秒, 随时可以修改
+            void setHeartbeat(int interval, int idle_timeout)
+            {
+                _link->setHeartbeat(interval, idle_timeout);
             }
             // 向外提供服务注册接口
+            // 发送之前就记下要注册的方法: 注册失败(例如 注册中心没有启动 / 连接断开)时返回 false,
+            // 之后连接上(切换到)注册中心节点时会自动重新注册, 不需要调用者重试
             bool serviceRegistry(const std::string &method, const Address &host)
             {
-                return _provider->serviceRegistry(_client->connection(), method, host);
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _registered[host].push_back(method);
+                }
+                return _provider->serviceRegistry(_link->client()->connection(), method, host);
+            }
+            // 批量注册: 一次往返注册 host 的所有方法(失败时同上)
+            bool serviceRegistry(const std::vector<std::string> &methods, const Address &host)
+            {
+                if (methods.empty())
+                    return true;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    auto &registered = _registered[host];
+                    registered.insert(registered.end(), methods.begin(), methods.end());
+                }
+                return _provider->serviceRegistry(_link->client()->connection(), methods, host);
+            }
+            // 每隔 interval 秒调用 sampler 采集一次负载并上报给注册中心(在客户端的 loop 线程中执行)
+            void startLoadReport(const Address &host, double interval, const LoadSampler &sampler)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _load_host = host;
+                    _load_interval = interval;
+                    _load_sampler = sampler;
+                }
+                startLoadReport(_link->client());
             }
             void shutdown()
             {
-                _client->shutdown();
+                _link->shutdown();
+            }
+
+        private:
+            void startLoadReport(const BaseClient::ptr &client)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (!_load_sampler)
+                    return;
+                std::weak_ptr<Provider> weak_provider = _provider;
+                BaseConnection::ptr conn = client->connection();
+                Address host = _load_host;
+                LoadSampler sampler = _load_sampler;
+                client->runEvery(_load_interval, [weak_provider, conn, host, sampler]()
+                                 {
+                                     auto provider = weak_provider.lock();
+                                     if (provider)
+                                         provider->loadReport(conn, host, sampler()); });
+            }
+            // 切换到了新的注册中心节点: 每个主机用一个批量请求重新注册之前注册过(包括注册失败)的方法，负载上报也转到新连接上
+            void onSwitch(const BaseClient::ptr &client)
+            {
+                std::map<Address, std::vector<std::string>> registered;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    registered = _registered;
+                }
+                for (auto &it : registered)
+                    _provider->serviceRegistry(client->connection(), it.second, it.first, [](bool) {});
+                startLoadReport(client);
             }
 
         private:
             Requestor::ptr _requestor;
             Provider::ptr _provider;
             Dispatcher::ptr _dispatcher;
-            BaseClient::ptr _client; // 里面包含 connnection
+            RegistryLink::ptr _link; // 里面包含 client 和 connnection
+            std::mutex _mutex;
+            std::map<Address, std::vector<std::string>> _registered; // 要注册的(不管这次是否成功): 主机 -> 方法
+            Address _load_host;
+            double _load_interval = 0;
+            LoadSampler _load_sampler;
         };
 
         class DiscoveryClient
@@ -54,6 +272,9 @@ namespace TrRpc
             using ptr = std::shared_ptr<DiscoveryClient>;
             // 传入注册中心信息, 连接注册中心
             DiscoveryClient(const std::string &ip, int port, const Discoverer::OfflineCallback &cb)
+                : DiscoveryClient(std::vector<Address>{Address(ip, port)}, cb) {}
+            // 注册中心集群: 连接其中一个节点，断开后切换到其它节点并重新发现
+            DiscoveryClient(const std::vector<Address> &nodes, const Discoverer::OfflineCallback &cb)
                 : _requestor(std::make_shared<Requestor>()),
                   _discoverer(std::make_shared<Discoverer>(_requestor, cb)),
                   _dispatcher(std::make_shared<Dispatcher>())
@@ -66,29 +287,44 @@ namespace TrRpc
                 _dispatcher->registerHandler<ServiceRequest>(MType::REQ_SERVICE, on_off_req_cb);
 
                 auto msg_cb = std::bind(&Dispatcher::OnMessage, _dispatcher.get(), std::placeholders::_1, std::placeholders::_2);
-                _client = ClientFactory::create(ip, port);
-                _client->SetMessageCallback(msg_cb);
-                _client->connect();
+                _link = std::make_shared<RegistryLink>(nodes, msg_cb);
+                auto switch_cb = [this](const BaseClient::ptr &client)
+                { _discoverer->resync(client->connection()); };
+                _link->setSwitchCallback(switch_cb);
+                _link->setFailCallback([this](const BaseConnection::ptr &conn)
+                                       { _requestor->failRequests(conn, RCode::RCODE_DISCONNECTED); });
+                _link->connect();
             }
 
+            // 心跳间隔 和 空闲超时(秒), 0 表示关闭; 默认 10 秒 / 30 秒, 随时可以修改
+            void setHeartbeat(int interval, int idle_timeout)
+            {
+                _link->setHeartbeat(interval, idle_timeout);
+            }
             bool serviceDiscovery(const std::string &method, Address &host)
             {
-                return _discoverer->serviceDiscovery(_client->connection(), method, host);
+                return _discoverer->serviceDiscovery(_link->client()->connection(), method, host);
+            }
+            // 异步服务发现, 结果通过回调返回
+            void serviceDiscovery(const std::string &method, const Discoverer::HostCallback &cb)
+            {
+                return _discoverer->serviceDiscovery(_link->client()->connection(), method, cb);
             }
 
         private:
             Requestor::ptr _requestor;
             Discoverer::ptr _discoverer;
             Dispatcher::ptr _dispatcher;
-            BaseClient::ptr _client; // 里面包含 connnection
+            RegistryLink::ptr _link; // 里面包含 client 和 connnection
         };
         class RpcClient
         {
         public:
             using ptr = std::shared_ptr<RpcClient>;
+            using ClientCallback = std::function<void(const BaseClient::ptr &)>; // 异步获取到 rpc 客户端以后的回调(失败时为空)
 
             RpcClient(bool enableDiscovery, const std::string &ip, int port)
-                : _enableDiscovery(enableDiscovery), _requestor(std::make_shared<Requestor>()),
+                : _enableDiscovery(enableDiscovery), _connect_timeout(defaultConnectTimeout), _requestor(std::make_shared<Requestor>()),
                   _caller(std::make_shared<RpcCaller>(_requestor)), _dispatcher(std::make_shared<Dispatcher>())
             {
                 // 对于 rpc_client 只会收到rpc_req
@@ -108,10 +344,41 @@ namespace TrRpc
                     _rpc_client = ClientFactory::create(ip, port);
                     auto rpc_rsp_cb = std::bind(&Dispatcher::OnMessage, _dispatcher.get(), std::placeholders::_1, std::placeholders::_2);
                     _rpc_client->SetMessageCallback(rpc_rsp_cb);
-                    _rpc_client->connect();
+                    _rpc_client->SetCloseCallback([this](BaseConnection::ptr &conn)
+                                                  { _requestor->failRequests(conn, RCode::RCODE_DISCONNECTED); });
+                    _rpc_client->asyncConnect();
                 }
             }
+            // 启用服务发现，注册中心是一个集群: 连接 reg_nodes 中的某个节点进行服务发现
+            RpcClient(const std::vector<Address> &reg_nodes)
+                : _enableDiscovery(true), _connect_timeout(defaultConnectTimeout), _requestor(std::make_shared<Requestor>()),
+                  _caller(std::make_shared<RpcCaller>(_requestor)), _dispatcher(std::make_shared<Dispatcher>())
+            {
+                auto rpc_rsp_cb = std::bind(&Requestor::onResponse, _requestor.get(), std::placeholders::_1, std::placeholders::_2);
+                _dispatcher->registerHandler<BaseMessage>(MType::RSP_RPC, rpc_rsp_cb);
+                auto offline_cb = std::bind(&RpcClient::delClient, this, std::placeholders::_1);
+                _discovery_client = std::make_shared<DiscoveryClient>(reg_nodes, offline_cb);
+            }
 
+            // 与服务提供者的连接在 seconds 秒内没有建立时放弃这个连接: 等待中的调用以 RCODE_DISCONNECTED 结束
+            // 连接从连接池中移除, 下次调用重新服务发现、建立连接; 0 表示一直等待(muduo 会一直重试连接)
+            void setConnectTimeout(double seconds)
+            {
+                _connect_timeout = seconds;
+            }
+            // 心跳间隔 和 空闲超时(秒), 0 表示关闭; 默认 10 秒 / 30 秒, 随时可以修改
+            void setHeartbeat(int interval, int idle_timeout)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _heartbeat_interval = interval;
+                _idle_timeout = idle_timeout;
+                if (_rpc_client)
+                    _rpc_client->setHeartbeat(interval, idle_timeout);
+                for (auto &it : _rpc_clients)
+                    it.second->setHeartbeat(interval, idle_timeout);
+                if (_discovery_client)
+                    _discovery_client->setHeartbeat(interval, idle_timeout);
+            }
             // 三种不同的调用方式
             bool call(const std::string &method, const Json::Value &params, Json::Value &result)
             {
@@ -124,39 +391,132 @@ namespace TrRpc
                 // 3. 通过客户端连接，发送rpc请求
                 return _caller->call(client->connection(), method, params, result);
             }
+            // 下面两种异步调用不会阻塞调用线程: 服务发现 -> 建立连接 -> 发送请求, 作为回调在客户端 loop 线程中依次执行
+            // 连接尚未建立时，请求先缓存在客户端中，连接建立后按顺序发出
+            // 返回 true 只表示请求已受理; 找不到服务提供者时, future 中会被设置异常
             bool call(const std::string &method, const Json::Value &params, RpcCaller::JsonAsyncResponse &result)
             {
-                BaseClient::ptr client = getRpcClient(method);
-                if (client.get() == nullptr)
-                {
-                    return false;
-                }
-                // 3. 通过客户端连接，发送rpc请求
-                return _caller->call(client->connection(), method, params, result);
+                auto json_promise = std::make_shared<std::promise<Json::Value>>();
+                result = json_promise->get_future();
+                RpcCaller::JsonResponseCallback cb = [json_promise](const Json::Value &rsp)
+                { json_promise->set_value(rsp); };
+                getRpcClient(method, [this, method, params, cb, json_promise](const BaseClient::ptr &client)
+                             {
+                                 if (client.get() == nullptr)
+                                 {
+                                     json_promise->set_exception(std::make_exception_ptr(std::runtime_error("没有找到服务提供者: " + method)));
+                                     return;
+                                 }
+                                 // 3. 通过客户端连接，发送rpc请求
+                                 if (_caller->call(client->connection(), method, params, cb) == false)
+                                     json_promise->set_exception(std::make_exception_ptr(std::runtime_error("发送 rpc 请求失败: " + method))); });
+                return true;
             }
             bool call(const std::string &method, const Json::Value &params, const RpcCaller::JsonResponseCallback &cb)
             {
-                BaseClient::ptr client = getRpcClient(method);
-                if (client.get() == nullptr)
-                {
-                    return false;
-                }
-                // 3. 通过客户端连接，发送rpc请求
-                return _caller->call(client->connection(), method, params, cb);
+                getRpcClient(method, [this, method, params, cb](const BaseClient::ptr &client)
+                             {
+                                 if (client.get() == nullptr)
+                                 {
+                                     ERR_LOG("异步调用 %s 失败: 没有可用的服务提供者", method.c_str());
+                                     return;
+                                 }
+                                 // 3. 通过客户端连接，发送rpc请求
+                                 _caller->call(client->connection(), method, params, cb); });
+                return true;
             }
+            // 可以组合的 future: 多个调用可以用 whenAll / whenAny 合并, 用 then 挂上后续处理, 都不需要线程阻塞等待
+            // 找不到服务提供者、请求出错时 future 以对应的错误码完成
+            bool call(const std::string &method, const Json::Value &params, RpcCaller::JsonFuture &result)
+            {
+                Promise<Json::Value> promise;
+                result = promise.future();
+                getRpcClient(method, [this, method, params, promise](const BaseClient::ptr &client)
+                             {
+                                 if (client.get() == nullptr)
+                                     return promise.setError(RCode::RCODE_NOT_FOUND_SERVICE);
+                                 _caller->call(client->connection(), method, params, promise); }); // 发送失败时 promise 以错误码完成
+                return true;
+            }
+            // 带错误码的异步回调: 找不到服务提供者、请求出错时也会回调
+            bool call(const std::string &method, const Json::Value &params, const RpcCaller::JsonResultCallback &cb)
+            {
+                getRpcClient(method, [this, method, params, cb](const BaseClient::ptr &client)
+                             {
+                                 if (client.get() == nullptr)
+                                     return cb(RCode::RCODE_NOT_FOUND_SERVICE, Json::Value());
+                                 if (_caller->call(client->connection(), method, params, cb) == false)
+                                     cb(RCode::RCODE_INTERNAL_ERROR, Json::Value()); });
+                return true;
+            }
+#ifdef TRRPC_COROUTINE
+            // C++20 协程: Json::Value result = co_await client.callAsync(method, params); 失败时抛出 RpcError
+            // 等待响应期间不占用任何线程; 协程在收到响应的客户端 loop 线程中恢复(设置了 setResumeExecutor 时在执行器中恢复)
+            // 在 loop 线程中恢复时不要再调用同步接口(同步接口要等 loop 线程收到响应)
+            RpcAwaiter callAsync(const std::string &method, const Json::Value &params)
+            {
+                return RpcAwaiter(method, [this, method, params](const RpcAwaiter::Done &done)
+                                  { call(method, params, RpcCaller::JsonResultCallback([done](RCode rcode, const Json::Value &result)
+                                                                                     {
+                                                                                         RpcResult rsp;
+                                                                                         rsp.rcode = rcode;
+                                                                                         rsp.result = result;
+                                                                                         done(std::move(rsp)); })); },
+                                  _resume_executor);
+            }
+            // 设置恢复协程的执行器(需要在 callAsync 之前设置)
+            void setResumeExecutor(const ResumeExecutor &executor)
+            {
+                _resume_executor = executor;
+            }
+#endif
 
         private:
             // 下面针对的都是 : 从 DiscoveryClient 得到的 客户端连接, 用于维护客户端连接池
+            // 建立和服务提供主机有连接的client: 只发起连接不等待，连接建立前发出的请求由客户端缓存，连接建立后按顺序发出
             BaseClient::ptr newClient(const Address &host)
             {
-                // 建立和服务提供主机有连接的client
+                std::vector<BaseClient::ptr> released; // 在解锁之后销毁
+                std::unique_lock<std::mutex> lock(_mutex);
+                // 可能在某个客户端的 loop 线程中(例如 请求失败的回调中重试), 只释放可以安全销毁的
+                releaseRetired(_retired_clients, released);
+                auto it = _rpc_clients.find(host);
+                if (it != _rpc_clients.end()) // 其他线程已经创建好了
+                    return it->second;
                 auto msg_cb = std::bind(&Dispatcher::OnMessage, _dispatcher.get(), std::placeholders::_1, std::placeholders::_2);
+                auto close_cb = std::bind(&RpcClient::onClientClose, this, host, std::placeholders::_1);
                 auto client = ClientFactory::create(host.first, host.second);
                 client->SetMessageCallback(msg_cb);
-                client->connect();
-                putClient(host, client);
+                client->SetCloseCallback(close_cb);
+                if (_heartbeat_interval >= 0)
+                    client->setHeartbeat(_heartbeat_interval, _idle_timeout);
+                client->asyncConnect();
+                if (_connect_timeout > 0)
+                {
+                    BaseClient *raw = client.get();
+                    client->runAfter(_connect_timeout, [this, host, raw]()
+                                     { onConnectTimeout(host, raw); });
+                }
+                _rpc_clients.insert(std::make_pair(host, client));
                 return client;
             }
+            // 连接超时检查(运行在该客户端自己的 loop 线程中): 还没有建立连接就移出连接池, 缓存的请求全部以错误结束
+            void onConnectTimeout(const Address &host, BaseClient *which)
+            {
+                BaseClient::ptr client;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    auto it = _rpc_clients.find(host);
+                    if (it == _rpc_clients.end() || it->second.get() != which || it->second->connected())
+                        return;
+                    client = it->second;
+                    _retired_clients.push_back(client); // 不能在自己的 loop 线程中释放
+                    _rpc_clients.erase(it);
+                }
+                ERR_LOG("连接服务提供者 %s:%d 超时", host.first.c_str(), host.second);
+                client->shutdown();
+                _requestor->failRequests(client->connection(), RCode::RCODE_DISCONNECTED);
+            }
             void putClient(const Address &host, BaseClient::ptr &client)
             {
                 std::unique_lock<std::mutex> lock(_mutex);
@@ -177,6 +537,39 @@ namespace TrRpc
                 std::unique_lock<std::mutex> lock(_mutex);
                 _rpc_clients.erase(host);
             }
+            // 与服务提供者的连接断开(如: 心跳超时被关闭)，从连接池中移除，下次调用会重新建立连接
+            // 这个回调运行在该客户端自己的 loop 线程中，不能在这里释放它，先挪到 _retired_clients 中
+            // 连接上还在等待响应的调用(同步 / future / 回调 / 协程)不会再有响应, 以 RCODE_DISCONNECTED 结束
+            void onClientClose(const Address &host, const BaseConnection::ptr &conn)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    auto it = _rpc_clients.find(host);
+                    if (it != _rpc_clients.end() && it->second->connection() == conn)
+                    {
+                        _retired_clients.push_back(it->second);
+                        _rpc_clients.erase(it);
+                    }
+                }
+                _requestor->failRequests(conn, RCode::RCODE_DISCONNECTED);
+            }
+            // 异步获取 RpcClient: 服务发现和建立连接都不阻塞调用线程，拿到客户端后调用 cb
+            void getRpcClient(const std::string &method, const ClientCallback &cb)
+            {
+                if (!_enableDiscovery)
+                    return cb(_rpc_client);
+                _discovery_client->serviceDiscovery(method, [this, method, cb](bool ok, const Address &host)
+                                                    {
+                                                        if (ok == false)
+                                                        {
+                                                            ERR_LOG("当前 %s 服务，没有找到服务提供者！", method.c_str());
+                                                            return cb(BaseClient::ptr());
+                                                        }
+                                                        BaseClient::ptr client = getClient(host);
+                                                        if (client.get() == nullptr)
+                                                            client = newClient(host);
+                                                        cb(client); });
+            }
             // 获取 RpcCLient 的真正接口，内部判断是否: 通过服务发现者，要从池里面拿
             BaseClient::ptr getRpcClient(const std::string &method)
             {
@@ -215,7 +608,11 @@ namespace TrRpc
                     return std::hash<std::string>{}(addr);
                 }
             };
+            static constexpr double defaultConnectTimeout = 3.0; // 默认的连接超时(秒)
             bool _enableDiscovery;
+            double _connect_timeout;
+            int _heartbeat_interval = -1; // 小于 0 表示没有设置过, 使用客户端的默认值
+            int _idle_timeout = -1;
             DiscoveryClient::ptr _discovery_client; // 启动了服务发现，需要用到的服务发现客户端
             Requestor::ptr _requestor;
             RpcCaller::ptr _caller;
@@ -225,6 +622,10 @@ namespace TrRpc
             //<"127.0.0.1:8080", client1>
             // 长连接: 我们获得一个主机的时候，先看看连接池里面有没有对应的客户端连接可以复用
             std::unordered_map<Address, BaseClient::ptr, AddressHash> _rpc_clients; // 用于服务发现的客户端连接池
+            std::vector<BaseClient::ptr> _retired_clients;                           // 已断开、等待释放的客户端
+#ifdef TRRPC_COROUTINE
+            ResumeExecutor _resume_executor;
+#endif
         };
         class TopicClient
         {
@@ -242,25 +643,94 @@ namespace TrRpc
                 // 身为客户端，可能会收到 客户端发来的主题消息请求
                 auto req_cb = std::bind(&TopicManager::onPublish, _topic_manager.get(), std::placeholders::_1, std::placeholders::_2);
                 _dispatcher->registerHandler<TopicRequest>(MType::REQ_TOPIC, req_cb);
+                auto binary_cb = std::bind(&TopicManager::onBinaryPublish, _topic_manager.get(), std::placeholders::_1, std::placeholders::_2);
+                _dispatcher->registerHandler<BinaryTopicMessage>(MType::REQ_TOPIC_BINARY, binary_cb);
                 
                 _client = ClientFactory::create(ip, port);
                 auto msg_cb = std::bind(&Dispatcher::OnMessage, _dispatcher.get(), std::placeholders::_1, std::placeholders::_2);
                 _client->SetMessageCallback(msg_cb);
-                _client->connect();
+                // 连接断开(例如 心跳超时被关闭): 等待中的请求(创建 / 订阅 / 需要确认的发布 ...)以 RCODE_DISCONNECTED 结束
+                _client->SetCloseCallback([this](BaseConnection::ptr &conn)
+                                          { _requestor->failRequests(conn, RCode::RCODE_DISCONNECTED); });
+                _client->asyncConnect(); // 不阻塞构造，连接建立前的请求会被缓存
+            }
+            // 心跳间隔 和 空闲超时(秒), 0 表示关闭; 默认 10 秒 / 30 秒, 随时可以修改
+            void setHeartbeat(int interval, int idle_timeout)
+            {
+                _client->setHeartbeat(interval, idle_timeout);
             }
             // 客户端的业务接口:
-            bool create(const std::string &key)
+            bool create(const std::string &key, OverflowPolicy policy = OverflowPolicy::DROP_OLDEST, size_t retain = 0, bool durable = false)
             {
-                return _topic_manager->create(_client->connection(), key);
+                return _topic_manager->create(_client->connection(), key, policy, retain, durable);
             }
             bool remove(const std::string &key)
             {
                 return _topic_manager->remove(_client->connection(), key);
             }
             // 订阅主题，并且传入: 后续收到订阅主题发来的消息以后的回调函数
-            bool subscribe(const std::string &key, const TopicManager::SubCallback &cb)
+            // from_seq 不为 0 时从这个序号开始重放服务端保留的消息(主题创建时需要指定 retain)
+            bool subscribe(const std::string &key, const TopicManager::SubCallback &cb, uint64_t from_seq = 0)
+            {
+                return _topic_manager->subscribe(_client->connection(), key, cb, from_seq);
+            }
+            // 以字节视图接收消息(不拷贝内容), 适合二进制消息
+            bool subscribeBinary(const std::string &key, const TopicManager::BinaryCallback &cb, uint64_t from_seq = 0)
+            {
+                return _topic_manager->subscribeBinary(_client->connection(), key, cb, from_seq);
+            }
+            // 发布二进制消息: 内容是任意字节, 按原样传输
+            bool publishBinary(const std::string &key, const char *data, size_t len)
+            {
+                return _topic_manager->publishBinary(_client->connection(), key, data, len);
+            }
+            bool publishBinary(const std::string &key, const char *data, size_t len, const TopicManager::PublishCallback &cb)
             {
-                return _topic_manager->subscribe(_client->connection(), key, cb);
+                return _topic_manager->publishBinary(_client->connection(), key, data, len, cb);
+            }
+            bool publishBinaryNoAck(const std::string &key, const char *data, size_t len)
+            {
+                return _topic_manager->publishBinaryNoAck(_client->connection(), key, data, len);
+            }
+            // 收到的某个主题最后一条消息的序号, 重新订阅时传入 lastSeq(key) + 1 可以补上断开期间的消息
+            uint64_t lastSeq(const std::string &key)
+            {
+                return _topic_manager->lastSeq(key);
+            }
+            // 用 threads 个线程执行订阅回调(需要在订阅之前设置): 同一个主题的消息按顺序回调, 不同主题的并行回调
+            void setDeliveryThreads(size_t threads)
+            {
+                _executor = std::make_shared<OrderedExecutor>(threads);
+                _topic_manager->setExecutor(_executor);
+            }
+            // 订阅回调的排队情况(没有设置回调线程时全为 0)
+            ExecutorStats deliveryStats()
+            {
+                return _executor ? _executor->stats() : ExecutorStats();
+            }
+            // 某个主题还在排队等待回调的消息数
+            size_t deliveryDepth(const std::string &key)
+            {
+                return _executor ? _executor->depth(key) : 0;
+            }
+            // 加入消费组: 同一组的订阅者合起来每条消息只收到一次, 用来把一个主题的消息分给多个工作者处理
+            bool join(const std::string &key, const std::string &group, const TopicManager::SubCallback &cb,
+                      GroupBalance balance = GroupBalance::ROUND_ROBIN)
+            {
+                return _topic_manager->join(_client->connection(), key, group, cb, balance);
+            }
+            bool leave(const std::string &key, const std::string &group)
+            {
+                return _topic_manager->leave(_client->connection(), key, group);
+            }
+            // 持久化主题: 以消费者 consumer 的身份订阅, 从上次 commit 的位置之后继续
+            bool resume(const std::string &key, const std::string &consumer, const TopicManager::SubCallback &cb)
+            {
+                return _topic_manager->resume(_client->connection(), key, consumer, cb);
+            }
+            bool commit(const std::string &key, const std::string &consumer, uint64_t seq)
+            {
+                return _topic_manager->commit(_client->connection(), key, consumer, seq);
             }
             // 取消订阅
             bool cancel(const std::string &key)
@@ -272,6 +742,72 @@ namespace TrRpc
             {
                 return _topic_manager->publish(_client->connection(), key, msg);
             }
+            // 异步发布: 不等待确认，确认结果通过回调 / future 获取
+            bool publish(const std::string &key, const std::string &msg, const TopicManager::PublishCallback &cb)
+            {
+                return _topic_manager->publish(_client->connection(), key, msg, cb);
+            }
+            bool publish(const std::string &key, const std::string &msg, std::future<bool> &result)
+            {
+                return _topic_manager->publish(_client->connection(), key, msg, result);
+            }
+            // 批量发布: 一个请求带多条消息(可以属于不同的主题)
+            bool publishBatch(const std::vector<TopicMessage> &msgs)
+            {
+                return _topic_manager->publishBatch(_client->connection(), msgs);
+            }
+            bool publishBatch(const std::string &key, const std::vector<std::string> &msgs)
+            {
+                return _topic_manager->publishBatch(_client->connection(), key, msgs);
+            }
+            bool publishBatch(const std::vector<TopicMessage> &msgs, const TopicManager::PublishCallback &cb)
+            {
+                return _topic_manager->publishBatch(_client->connection(), msgs, cb);
+            }
+            // 不需要确认的发布: 服务端不回复
+            bool publishNoAck(const std::string &key, const std::string &msg)
+            {
+                return _topic_manager->publishNoAck(_client->connection(), key, msg);
+            }
+#ifdef TRRPC_COROUTINE
+            // C++20 协程: 主题操作的 co_await 版本, 得到服务端是否处理成功, 等待期间不占用线程
+            // 协程在连接的 loop 线程中恢复(设置了 setResumeExecutor 时在执行器中恢复)
+            TopicAwaiter createAsync(const std::string &key, OverflowPolicy policy = OverflowPolicy::DROP_OLDEST, size_t retain = 0, bool durable = false)
+            {
+                return awaitTopic([this, key, policy, retain, durable](const TopicManager::ResultCallback &done)
+                                  { _topic_manager->create(_client->connection(), key, policy, retain, durable, done); });
+            }
+            TopicAwaiter removeAsync(const std::string &key)
+            {
+                return awaitTopic([this, key](const TopicManager::ResultCallback &done)
+                                  { _topic_manager->remove(_client->connection(), key, done); });
+            }
+            TopicAwaiter subscribeAsync(const std::string &key, const TopicManager::SubCallback &cb, uint64_t from_seq = 0)
+            {
+                return awaitTopic([this, key, cb, from_seq](const TopicManager::ResultCallback &done)
+                                  { _topic_manager->subscribe(_client->connection(), key, cb, from_seq, done); });
+            }
+            TopicAwaiter cancelAsync(const std::string &key)
+            {
+                return awaitTopic([this, key](const TopicManager::ResultCallback &done)
+                                  { _topic_manager->cancel(_client->connection(), key, done); });
+            }
+            TopicAwaiter publishAsync(const std::string &key, const std::string &msg)
+            {
+                return awaitTopic([this, key, msg](const TopicManager::ResultCallback &done)
+                                  { _topic_manager->publish(_client->connection(), key, msg, done); });
+            }
+            // data 在 co_await 返回之前需要一直有效
+            TopicAwaiter publishBinaryAsync(const std::string &key, const char *data, size_t len)
+            {
+                return awaitTopic([this, key, data, len](const TopicManager::ResultCallback &done)
+                                  { _topic_manager->publishBinary(_client->connection(), key, data, len, done); });
+            }
+            void setResumeExecutor(const ResumeExecutor &executor)
+            {
+                _resume_executor = executor;
+            }
+#endif
             // onPublish: 是被动回调的接口
             void shutdown()
             {
@@ -279,10 +815,20 @@ namespace TrRpc
             }
 
         private:
+            OrderedExecutor::ptr _executor; // 订阅回调的执行器(最后析构: 先停掉连接, 再执行完排队的回调)
             Requestor::ptr _requestor;
             TopicManager::ptr _topic_manager;
             Dispatcher::ptr _dispatcher;
             BaseClient::ptr _client; // 里面包含 connnection
+#ifdef TRRPC_COROUTINE
+            ResumeExecutor _resume_executor;
+            TopicAwaiter awaitTopic(const std::function<void(const TopicManager::ResultCallback &)> &start)
+            {
+                return TopicAwaiter([start](const TopicAwaiter::Done &done)
+                                    { start(TopicManager::ResultCallback(done)); },
+                                    _resume_executor);
+            }
+#endif
         };
     }
 }
\ No newline at end of file
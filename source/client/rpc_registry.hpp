@@ -42,31 +42,117 @@ namespace TrRpc
                 }
                 return true;
             }
+            // 批量服务注册: 一个请求注册一个主机的所有方法(一次往返)
+            bool serviceRegistry(const BaseConnection::ptr &conn, const std::vector<std::string> &methods, const Address &host)
+            {
+                BaseMessage::ptr msg_rsp;
+                bool ret = _requestor->send(conn, bulkRequest(methods, host), msg_rsp);
+                if (ret == false)
+                {
+                    ERR_LOG("批量服务注册失败！");
+                    return false;
+                }
+                auto svr_rsp = std::dynamic_pointer_cast<ServiceResponse>(msg_rsp);
+                if (svr_rsp.get() == nullptr)
+                {
+                    ERR_LOG("响应类型向下转换失败！");
+                    return false;
+                }
+                if (svr_rsp->rcode() != RCode::RCODE_OK)
+                {
+                    ERR_LOG("批量服务注册失败，原因：%s", errReason(svr_rsp->rcode()).c_str());
+                    return false;
+                }
+                return true;
+            }
+            // 异步批量服务注册: 不等待响应(用于切换注册中心节点后重新注册)，结果通过 cb 返回
+            void serviceRegistry(const BaseConnection::ptr &conn, const std::vector<std::string> &methods, const Address &host, const std::function<void(bool)> &cb)
+            {
+                Requestor::RequestCallback rsp_cb = [cb](const BaseMessage::ptr &msg_rsp)
+                {
+                    auto svr_rsp = std::dynamic_pointer_cast<ServiceResponse>(msg_rsp);
+                    bool ok = svr_rsp && svr_rsp->rcode() == RCode::RCODE_OK;
+                    if (ok == false)
+                        ERR_LOG("批量服务注册失败！");
+                    cb(ok);
+                };
+                if (_requestor->send(conn, bulkRequest(methods, host), rsp_cb) == false)
+                    cb(false);
+            }
+            // 负载上报: 只管发出去，不需要响应(注册中心据此调整该主机的权重)
+            bool loadReport(const BaseConnection::ptr &conn, const Address &host, const LoadInfo &load)
+            {
+                ServiceRequest::ptr svr_req = MessageFactory::create<ServiceRequest>();
+                svr_req->setId(UUid::uuid());
+                svr_req->setMtype(MType::REQ_SERVICE);
+                svr_req->setHost(host);
+                svr_req->setOptype(ServiceOptype::SERVICE_LOAD);
+                svr_req->setLoad(load);
+                if (conn->connected() == false)
+                    return false;
+                conn->send(svr_req);
+                return true;
+            }
+        private:
+            ServiceRequest::ptr bulkRequest(const std::vector<std::string> &methods, const Address &host)
+            {
+                ServiceRequest::ptr svr_req = MessageFactory::create<ServiceRequest>();
+                svr_req->setId(UUid::uuid());
+                svr_req->setMtype(MType::REQ_SERVICE);
+                svr_req->setMethods(methods);
+                svr_req->setHost(host);
+                svr_req->setOptype(ServiceOptype::SERVICE_BULK_REGISTRY);
+                return svr_req;
+            }
+
         private:
             Requestor::ptr _requestor; // 发送请求需要用这个模块的特殊 send 接口
         };
 
         // 当获取一个服务的所有提供者的时候
-        // 1. 我们将它保存起来  2. 采用 RR 轮转的方式进行访问(避免一个主机负载太大)
+        // 1. 我们将它保存起来  2. 采用平滑加权轮转的方式进行访问(权重由注册中心根据各主机上报的负载计算, 负载低的主机分到更多请求)
+        //    所有主机权重相同时，就是普通的 RR 轮转
         class MethodHost // 用来描述一个方法 所有能提供该服务的主机
         {
         public:
             using ptr = std::shared_ptr<MethodHost>;
-            MethodHost() : _idx(0) {}
-            MethodHost(const std::vector<Address> &host)
-                : _hosts(host.begin(), host.end()) {}
+            MethodHost() : _version(0) {}
+            MethodHost(const std::vector<Address> &host, const std::vector<int> &weights = std::vector<int>(), uint64_t version = 0)
+                : _version(version)
+            {
+                for (size_t i = 0; i < host.size(); i++)
+                    _hosts.push_back(Node(host[i], i < weights.size() ? weights[i] : DEFAULT_WEIGHT));
+            }
 
-            void addHost(const Address &host)
+            // 中途收到了服务上线请求后被调用: 主机已存在时只更新权重(注册中心通过上线通知下发新权重)
+            void addHost(const Address &host, int weight = DEFAULT_WEIGHT)
             {
-                // 中途收到了服务上线请求后被调用
                 std::unique_lock<std::mutex> lock(_mutex);
-                _hosts.emplace_back(host);
+                for (auto &node : _hosts)
+                {
+                    if (node.host == host)
+                    {
+                        node.weight = std::max(1, weight);
+                        return;
+                    }
+                }
+                _hosts.push_back(Node(host, weight));
             }
+            // 平滑加权轮转: 每次所有主机 current += weight, 选出 current 最大的, 然后它的 current -= 总权重
             Address chooseHost()
             {
                 std::unique_lock<std::mutex> lock(_mutex);
-                int pos = _idx++ % _hosts.size();
-                return _hosts[pos];
+                int total = 0;
+                Node *best = nullptr;
+                for (auto &node : _hosts)
+                {
+                    node.current += node.weight;
+                    total += node.weight;
+                    if (best == nullptr || node.current > best->current)
+                        best = &node;
+                }
+                best->current -= total;
+                return best->host;
             }
             void removeHost(const Address &host)
             {
@@ -74,7 +160,7 @@ namespace TrRpc
                 std::unique_lock<std::mutex> lock(_mutex);
                 for (auto it = _hosts.begin(); it != _hosts.end(); it++)
                 {
-                    if (*it == host)
+                    if (it->host == host)
                     {
                         _hosts.erase(it);
                         break;
@@ -86,71 +172,76 @@ namespace TrRpc
                 std::unique_lock<std::mutex> lock(_mutex);
                 return _hosts.empty();
             }
+            // 主机列表对应的注册中心版本号: 版本号不大于它的增量变化已经包含在列表中，不能再应用
+            uint64_t version()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                return _version;
+            }
+            void setVersion(uint64_t version)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _version = version;
+            }
 
         private:
+            struct Node
+            {
+                Node(const Address &h, int w) : host(h), weight(std::max(1, w)), current(0) {}
+                Address host;
+                int weight;  // 权重
+                int current; // 平滑加权轮转的当前值
+            };
             std::mutex _mutex;
-            int _idx; // 用于轮转
-            std::vector<Address> _hosts;
+            uint64_t _version;
+            std::vector<Node> _hosts;
         };
         class Discoverer
         {
         public:
             using OfflineCallback = std::function<void(const Address &)>;
+            using DiscoveryCallback = std::function<void(bool)>; // 一次服务发现结束后的回调: 参数表示是否找到了服务提供者
+            using HostCallback = std::function<void(bool, const Address &)>; // 异步服务发现的结果回调: (是否成功, 选中的主机)
             using ptr = std::shared_ptr<Discoverer>;
             Discoverer(Requestor::ptr requestor, const OfflineCallback &cb)
-                : _requestor(requestor), _offline_callback(cb) {}
+                : _offline_callback(cb),
+                  _negative_ttl(std::chrono::milliseconds(defaultNegativeTTL)), _requestor(requestor) {}
+            // 设置 "没有服务提供者" 结果的缓存时间(负缓存), 为 0 表示不缓存
+            void setNegativeTTL(int ms)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _negative_ttl = std::chrono::milliseconds(ms);
+            }
             // 客户端 conn 对 method 进行服务发现，host 是输出型参数, 客户端拿到host以后，通过host进行Rpc服务调用
             bool serviceDiscovery(const BaseConnection::ptr &conn, const std::string &method, Address &host)
             {
-                // 如果有能提供服务的主机
-                {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    auto it = _method_hosts.find(method);
-                    if (it != _method_hosts.end() && !it->second->empty())
-                    {
-                        host = it->second->chooseHost();
-                        return true;
-                    }
-                }
-
-                // 如果没有能提供服务的主机 --> 进行服务发现
-                auto service_req = MessageFactory::create<ServiceRequest>();
-                service_req->setId(UUid::uuid());
-                service_req->setMethod(method);
-                service_req->setMtype(MType::REQ_SERVICE);
-                service_req->setOptype(ServiceOptype::SERVICE_DISCOVERY);
-                // auto msg_rsp = MessageFactory::create<BaseMessage>(); 抽象类内部有多个纯虚函数，无法被直接实例化
-                BaseMessage::ptr msg_rsp; // 声明
-                bool ret = _requestor->send(conn, service_req, msg_rsp);
-                if (ret == false)
-                {
-                    ERR_LOG("服务发现失败");
-                    return false;
-                }
-                auto service_rsp = std::dynamic_pointer_cast<ServiceResponse>(msg_rsp);
-                if (service_rsp->rcode() != RCode::RCODE_OK)
-                {
-                    ERR_LOG("服务发现失败, 错误原因: %s", errReason(service_rsp->rcode()).c_str());
-                    return false;
-                }
-                if (service_rsp == nullptr)
-                {
-                    ERR_LOG("响应类型转换失败");
+                // 如果有能提供服务的主机, 直接选一个
+                if (chooseHost(method, host))
+                    return true;
+                // 没有能提供服务的主机 --> 进行服务发现 (同一方法的并发发现会被合并成一次请求)
+                auto done = std::make_shared<std::promise<bool>>();
+                std::future<bool> fut = done->get_future();
+                discover(conn, method, [done](bool ok)
+                         { done->set_value(ok); });
+                if (fut.get() == false)
                     return false;
-                }
                 // 走到这里，一定是一开始没有能提供服务的主机，然后进行完了服务发现
-                {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    auto hosts = std::make_shared<MethodHost>(service_rsp->hosts());
-                    if (hosts->empty())
-                    {
-                        ERR_LOG("服务发现失败，没有可提供服务的主机");
-                        return false;
-                    }
-                    _method_hosts[method] = hosts;
-                    host = hosts->chooseHost();
-                    return true;
-                }
+                return chooseHost(method, host);
+            }
+
+            // 异步服务发现: 不阻塞调用线程, 结果通过 cb 返回
+            // 缓存命中时在当前线程直接回调，否则在收到发现响应的(客户端 loop)线程中回调
+            void serviceDiscovery(const BaseConnection::ptr &conn, const std::string &method, const HostCallback &cb)
+            {
+                Address host;
+                if (chooseHost(method, host))
+                    return cb(true, host);
+                discover(conn, method, [this, method, cb](bool ok)
+                         {
+                             Address host;
+                             if (ok && chooseHost(method, host))
+                                 return cb(true, host);
+                             cb(false, Address()); });
             }
 
             // 这个接口是提供给Dispatcher模块进行服务上线下线请求处理的 "回调函数"
@@ -160,21 +251,23 @@ namespace TrRpc
                 // 上线和下线请求是: 服务提供者的上线/下线
                 auto optype = msg->optype();
                 auto method = msg->method();
+                if (optype == ServiceOptype::SERVICE_DELTA)
+                    return onDelta(conn, msg);
                 {
                     std::unique_lock<std::mutex> lock(_mutex);
                     if (optype == ServiceOptype::SERVICE_ONLINE)
                     {
                         // 2. 上线请求：找到MethodHost，向其中新增一个主机地址
-
+                        _negative_cache.erase(method); // 有提供者上线了, 负缓存失效
                         auto it = _method_hosts.find(method);
                         if (it == _method_hosts.end())
                         {
                             auto hosts = std::make_shared<MethodHost>();
-                            hosts->addHost(msg->host());
+                            hosts->addHost(msg->host(), msg->weight());
                             _method_hosts[method] = hosts;
                         }
                         else
-                            it->second->addHost(msg->host());
+                            it->second->addHost(msg->host(), msg->weight());
                     }
                     else if (optype == ServiceOptype::SERVICE_OFFLINE) // 服务提供者的下线通知
                     {
@@ -188,10 +281,190 @@ namespace TrRpc
                 }
             }
 
+            // 换了一个注册中心节点: 之前的连接上还没回来的发现请求不会再有响应了
+            // 把在途的 和 已经缓存的方法都在新连接上重新发现一遍，这样新节点才知道要给我们发上下线通知
+            // 缓存的主机列表在新的响应到达之前继续使用, 但是版本号清零: 版本号是旧节点的, 不能用来过滤新节点的增量通知
+            void resync(const BaseConnection::ptr &conn)
+            {
+                std::vector<std::string> methods;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _delta_version = 0; // 新连接上的增量通知从头开始
+                    for (auto &it : _method_hosts)
+                    {
+                        it.second->setVersion(0);
+                        _inflight[it.first]; // 没有等待者的在途请求，只用来合并并发的发现
+                    }
+                    for (auto &it : _inflight)
+                        methods.push_back(it.first);
+                }
+                for (auto &method : methods)
+                    sendDiscovery(conn, method);
+            }
+
+        private:
+            // 增量通知: prev_version 与上一条收到的增量通知的版本号对不上，说明中间漏掉了通知，全部重新发现一遍
+            // 否则逐个应用变化, 版本号不大于本地主机列表版本号的变化已经包含在服务发现响应中了，直接跳过
+            void onDelta(const BaseConnection::ptr &conn, const ServiceRequest::ptr &msg)
+            {
+                std::vector<Address> offline;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if (msg->prevVersion() != _delta_version)
+                    {
+                        INF_LOG("增量通知版本不连续(期望 %lu, 收到 %lu)，重新进行服务发现", (unsigned long)_delta_version, (unsigned long)msg->prevVersion());
+                        lock.unlock();
+                        resync(conn);
+                        lock.lock();
+                        _delta_version = msg->version();
+                        return;
+                    }
+                    _delta_version = msg->version();
+                    for (auto &change : msg->changes())
+                    {
+                        auto it = _method_hosts.find(change.method);
+                        if (change.optype == ServiceOptype::SERVICE_ONLINE)
+                        {
+                            _negative_cache.erase(change.method); // 有提供者上线了, 负缓存失效
+                            if (it == _method_hosts.end())
+                                it = _method_hosts.insert(std::make_pair(change.method, std::make_shared<MethodHost>())).first;
+                            if (change.version <= it->second->version())
+                                continue;
+                            it->second->addHost(change.host, change.weight);
+                            it->second->setVersion(change.version);
+                        }
+                        else if (change.optype == ServiceOptype::SERVICE_OFFLINE)
+                        {
+                            if (it == _method_hosts.end() || change.version <= it->second->version())
+                                continue;
+                            it->second->removeHost(change.host);
+                            it->second->setVersion(change.version);
+                            offline.push_back(change.host);
+                        }
+                    }
+                }
+                for (auto &host : offline)
+                    _offline_callback(host);
+            }
+            // 从缓存中选择一个主机, 没有可用主机时返回 false
+            bool chooseHost(const std::string &method, Address &host)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto it = _method_hosts.find(method);
+                if (it == _method_hosts.end() || it->second->empty())
+                    return false;
+                host = it->second->chooseHost();
+                return true;
+            }
+            // 发起(或加入)一次服务发现, 结束后通过 cb 通知结果
+            // 1. 负缓存未过期: 直接失败，不再打扰注册中心
+            // 2. 已有同一方法的在途请求: 只登记回调, 共享那次请求的结果
+            // 3. 否则由当前调用者发出请求, 响应到达时唤醒所有等待者
+            void discover(const BaseConnection::ptr &conn, const std::string &method, const DiscoveryCallback &cb)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    auto neg_it = _negative_cache.find(method);
+                    if (neg_it != _negative_cache.end())
+                    {
+                        if (std::chrono::steady_clock::now() < neg_it->second)
+                        {
+                            lock.unlock();
+                            DBG_LOG("%s 服务近期没有提供者(负缓存命中)", method.c_str());
+                            return cb(false);
+                        }
+                        _negative_cache.erase(neg_it);
+                    }
+                    auto it = _inflight.find(method);
+                    if (it != _inflight.end())
+                    {
+                        it->second.push_back(cb);
+                        return;
+                    }
+                    _inflight[method].push_back(cb);
+                }
+                sendDiscovery(conn, method);
+            }
+            // 发出服务发现请求，响应在 onDiscoveryResponse 中处理
+            void sendDiscovery(const BaseConnection::ptr &conn, const std::string &method)
+            {
+                auto service_req = MessageFactory::create<ServiceRequest>();
+                service_req->setId(UUid::uuid());
+                service_req->setMethod(method);
+                service_req->setMtype(MType::REQ_SERVICE);
+                service_req->setOptype(ServiceOptype::SERVICE_DISCOVERY);
+                Requestor::RequestCallback rsp_cb = std::bind(&Discoverer::onDiscoveryResponse, this, method, std::placeholders::_1);
+                bool ret = _requestor->send(conn, service_req, rsp_cb);
+                if (ret == false)
+                {
+                    ERR_LOG("服务发现失败");
+                    finishDiscovery(method, false);
+                }
+            }
+            // 服务发现响应的回调处理: 更新缓存后唤醒所有等待该方法的调用者
+            void onDiscoveryResponse(const std::string &method, const BaseMessage::ptr &msg_rsp)
+            {
+                auto service_rsp = std::dynamic_pointer_cast<ServiceResponse>(msg_rsp);
+                if (service_rsp == nullptr)
+                {
+                    ERR_LOG("响应类型转换失败");
+                    return finishDiscovery(method, false);
+                }
+                if (service_rsp->rcode() != RCode::RCODE_OK && service_rsp->rcode() != RCode::RCODE_NOT_FOUND_SERVICE)
+                {
+                    ERR_LOG("服务发现失败, 错误原因: %s", errReason(service_rsp->rcode()).c_str());
+                    return finishDiscovery(method, false);
+                }
+                bool found = false;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    auto hosts = std::make_shared<MethodHost>(service_rsp->hosts(), service_rsp->weights(), service_rsp->version());
+                    if (service_rsp->rcode() == RCode::RCODE_OK && !hosts->empty())
+                    {
+                        _method_hosts[method] = hosts;
+                        found = true;
+                    }
+                    else
+                    {
+                        // 注册中心明确回答没有提供者: 去掉旧的主机列表(连同它的版本号), 之后的上线通知才能生效
+                        _method_hosts.erase(method);
+                        if (_negative_ttl.count() > 0)
+                            _negative_cache[method] = std::chrono::steady_clock::now() + _negative_ttl;
+                    }
+                }
+                if (!found)
+                    ERR_LOG("服务发现失败，没有可提供 %s 服务的主机", method.c_str());
+                finishDiscovery(method, found);
+            }
+            void finishDiscovery(const std::string &method, bool ok)
+            {
+                std::vector<DiscoveryCallback> waiters;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    auto it = _inflight.find(method);
+                    if (it == _inflight.end())
+                        return;
+                    waiters.swap(it->second);
+                    _inflight.erase(it);
+                }
+                for (auto &waiter : waiters)
+                    waiter(ok);
+            }
+
         private:
+            enum
+            {
+                defaultNegativeTTL = 500 // 负缓存默认时长(ms); 用枚举: 传给 milliseconds 的引用参数也不需要类外定义
+            };
             OfflineCallback _offline_callback;
             std::mutex _mutex;
             std::unordered_map<std::string, MethodHost::ptr> _method_hosts;
+            uint64_t _delta_version = 0; // 上一条收到的增量通知的版本号
+            // 正在进行中的服务发现: 方法 -> 等待该次发现结果的回调
+            std::unordered_map<std::string, std::vector<DiscoveryCallback>> _inflight;
+            // 负缓存: 方法 -> 过期时间, 过期前对该方法的服务发现直接失败
+            std::unordered_map<std::string, std::chrono::steady_clock::time_point> _negative_cache;
+            std::chrono::milliseconds _negative_ttl;
             Requestor::ptr _requestor;
         };
 
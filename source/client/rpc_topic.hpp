@@ -1,5 +1,6 @@
 #pragma once
 #include "requestor.hpp"
+#include "executor.hpp"
 
 namespace TrRpc
 {
@@ -11,44 +12,255 @@ namespace TrRpc
             using ptr = std::shared_ptr<TopicManager>;
             // 收到 订阅的 key 主题 发布过来的 msg 消息的回调
             using SubCallback = std::function<void(const std::string &key, const std::string &msg)>;
+            // 异步操作的结果回调: 服务端处理成功时为 true (在连接的 I/O 线程中调用)
+            using ResultCallback = std::function<void(bool ok)>;
+            // 异步发布的结果回调: 服务端确认收到并转发了消息时为 true
+            using PublishCallback = ResultCallback;
+            // 以原始字节接收消息的回调: data 指向收到的消息内部, 只在回调期间有效
+            using BinaryCallback = std::function<void(const std::string &key, const char *data, size_t len)>;
 
             TopicManager(const Requestor::ptr &requestor)
                 : _requestor(requestor) {}
+            // 设置执行订阅回调的执行器(需要在订阅之前设置): 同一个主题的消息按顺序回调, 不同主题的并行回调
+            // 不设置时直接在连接的 I/O 线程中回调, 一个很慢的回调会拖住这条连接上所有主题的消息和响应
+            void setExecutor(const OrderedExecutor::ptr &executor)
+            {
+                _executor = executor;
+            }
             // 1. 构建对应的请求发送给服务端;  2. 维护好 client 的 TopicManager
-            bool create(const BaseConnection::ptr &conn, const std::string &key)
+            // policy: 订阅者消费太慢、服务端为它缓存的消息满了以后的处理策略
+            // retain: 服务端为这个主题保留最近多少条消息, 订阅时可以从某个序号开始重放
+            // durable: 消息写入服务端的持久化日志(服务端需要开启, 没有开启或者日志创建失败时创建失败), 服务端重启后仍然可以重放
+            bool create(const BaseConnection::ptr &conn, const std::string &key, OverflowPolicy policy = OverflowPolicy::DROP_OLDEST, size_t retain = 0, bool durable = false)
             {
                 // 创建主题，与 _topic_callbacks 无关
-                return commonRequest(conn, key, TopicOptype::TOPIC_CREATE);
+                return request(conn, newCreateRequest(key, policy, retain, durable));
+            }
+            // 异步创建: 结果通过回调通知(下面几个带 ResultCallback 的接口相同)
+            bool create(const BaseConnection::ptr &conn, const std::string &key, OverflowPolicy policy, size_t retain, bool durable, const ResultCallback &cb)
+            {
+                return request(conn, newCreateRequest(key, policy, retain, durable), cb);
             }
             bool remove(const BaseConnection::ptr &conn, const std::string &key)
             {
                 return commonRequest(conn, key, TopicOptype::TOPIC_REMOVE);
             }
+            bool remove(const BaseConnection::ptr &conn, const std::string &key, const ResultCallback &cb)
+            {
+                return request(conn, newRequest(key, TopicOptype::TOPIC_REMOVE), cb);
+            }
             // 订阅主题，并且传入: 后续收到订阅主题发来的消息以后的回调函数
-            bool subscribe(const BaseConnection::ptr &conn, const std::string &key, const SubCallback &cb)
+            // key 可以带通配符('*' 匹配一层, '#' 匹配剩下的任意多层), 例如 market.*.ticks, market.#
+            // from_seq 不为 0 时, 服务端先重放它保留的、序号从 from_seq 开始的消息(例如断线重连后传入 lastSeq(key) + 1)
+            // 重放的第一条消息序号大于 from_seq 说明中间的消息已经不在服务端的保留范围内了
+            bool subscribe(const BaseConnection::ptr &conn, const std::string &key, const SubCallback &cb, uint64_t from_seq = 0)
             {
                 addSubscribe(key, cb);
-                bool ret = commonRequest(conn, key, TopicOptype::TOPIC_SUBSCRIBE);
+                auto msg_req = newRequest(key, TopicOptype::TOPIC_SUBSCRIBE);
+                if (from_seq > 0)
+                    msg_req->setSeq(from_seq);
+                bool ret = request(conn, msg_req);
                 if (ret == false) // 如果订阅失败了，要删除掉对应的主题的消息回调
                     delSubscribe(key);
                 return ret;
             }
+            bool subscribe(const BaseConnection::ptr &conn, const std::string &key, const SubCallback &cb, uint64_t from_seq, const ResultCallback &done)
+            {
+                addSubscribe(key, cb);
+                auto msg_req = newRequest(key, TopicOptype::TOPIC_SUBSCRIBE);
+                if (from_seq > 0)
+                    msg_req->setSeq(from_seq);
+                return request(conn, msg_req, [this, key, done](bool ok)
+                               {
+                                   if (ok == false)
+                                       delSubscribe(key);
+                                   if (done)
+                                       done(ok); });
+            }
+            // 以消费组 group 成员的身份订阅: 同一组的所有订阅者(可以在不同的客户端上)合起来, 每条消息只有一个成员收到
+            // balance: 组内挑选接收者的策略, 由组内第一个加入的订阅者决定
+            bool join(const BaseConnection::ptr &conn, const std::string &key, const std::string &group, const SubCallback &cb,
+                      GroupBalance balance = GroupBalance::ROUND_ROBIN)
+            {
+                addSubscribe(key, cb);
+                auto msg_req = newRequest(key, TopicOptype::TOPIC_SUBSCRIBE);
+                msg_req->setGroup(group);
+                msg_req->setBalance(balance);
+                bool ret = request(conn, msg_req);
+                if (ret == false)
+                    delSubscribe(key);
+                return ret;
+            }
+            // 退出消费组(直接订阅 或 其它组的订阅不受影响, 所以不删除回调)
+            bool leave(const BaseConnection::ptr &conn, const std::string &key, const std::string &group)
+            {
+                auto msg_req = newRequest(key, TopicOptype::TOPIC_CANCEL);
+                msg_req->setGroup(group);
+                return request(conn, msg_req);
+            }
+            // 以消费者 consumer 的身份订阅持久化主题: 从这个消费者上次提交的位置之后继续(没有提交过时只接收新消息)
+            bool resume(const BaseConnection::ptr &conn, const std::string &key, const std::string &consumer, const SubCallback &cb)
+            {
+                addSubscribe(key, cb);
+                auto msg_req = newRequest(key, TopicOptype::TOPIC_SUBSCRIBE);
+                msg_req->setConsumer(consumer);
+                bool ret = request(conn, msg_req);
+                if (ret == false)
+                    delSubscribe(key);
+                return ret;
+            }
+            // 提交消费位置: 序号 seq 以及之前的消息都处理完了
+            bool commit(const BaseConnection::ptr &conn, const std::string &key, const std::string &consumer, uint64_t seq)
+            {
+                auto msg_req = newRequest(key, TopicOptype::TOPIC_COMMIT);
+                msg_req->setConsumer(consumer);
+                msg_req->setSeq(seq);
+                return request(conn, msg_req);
+            }
+            // 订阅主题, 以字节视图接收消息(不拷贝内容): 二进制消息直接给出内容, 普通消息给出消息字符串的内容
+            bool subscribeBinary(const BaseConnection::ptr &conn, const std::string &key, const BinaryCallback &cb, uint64_t from_seq = 0)
+            {
+                Subscription subscription;
+                subscription.binary = cb;
+                addSubscribe(key, subscription);
+                auto msg_req = newRequest(key, TopicOptype::TOPIC_SUBSCRIBE);
+                if (from_seq > 0)
+                    msg_req->setSeq(from_seq);
+                bool ret = request(conn, msg_req);
+                if (ret == false)
+                    delSubscribe(key);
+                return ret;
+            }
             // 取消订阅
             bool cancel(const BaseConnection::ptr &conn, const std::string &key)
             {
                 delSubscribe(key);
                 return commonRequest(conn, key, TopicOptype::TOPIC_CANCEL);
             }
+            bool cancel(const BaseConnection::ptr &conn, const std::string &key, const ResultCallback &cb)
+            {
+                delSubscribe(key);
+                return request(conn, newRequest(key, TopicOptype::TOPIC_CANCEL), cb);
+            }
             // 向主题发送消息: 用于 消息发送客户端
             bool publish(const BaseConnection::ptr &conn, const std::string &key, const std::string &msg)
             {
                 return commonRequest(conn, key, TopicOptype::TOPIC_PUBLISH, msg);
             }
+            // 异步发布: 不等待响应直接返回，服务端的确认通过回调通知
+            // 一条连接上可以同时有任意多条发布在等待确认，服务端按发送顺序处理
+            bool publish(const BaseConnection::ptr &conn, const std::string &key, const std::string &msg, const PublishCallback &cb)
+            {
+                auto msg_req = newRequest(key, TopicOptype::TOPIC_PUBLISH);
+                msg_req->setTopicMsg(msg);
+                return request(conn, msg_req, cb);
+            }
+            // 异步发布: 通过 future 获取服务端的确认结果
+            bool publish(const BaseConnection::ptr &conn, const std::string &key, const std::string &msg, std::future<bool> &result)
+            {
+                auto promise = std::make_shared<std::promise<bool>>();
+                result = promise->get_future();
+                return publish(conn, key, msg, [promise](bool ok)
+                               { promise->set_value(ok); });
+            }
+            // 批量发布: 多条消息(可以属于不同的主题)放在一个请求中，服务端按顺序推送给订阅者
+            // 有主题不存在时返回 false, 但其它主题的消息已经发布了
+            bool publishBatch(const BaseConnection::ptr &conn, const std::vector<TopicMessage> &msgs)
+            {
+                // 太大的批量拆成多个请求依次发送(见 TopicRequest::maxBatchBytes), 中途失败时前面的几批已经发布
+                for (auto &batch : TopicRequest::splitBatch(msgs))
+                {
+                    if (request(conn, newBatchRequest(batch)) == false)
+                        return false;
+                }
+                return true;
+            }
+            // 同一个主题的多条消息
+            bool publishBatch(const BaseConnection::ptr &conn, const std::string &key, const std::vector<std::string> &msgs)
+            {
+                std::vector<TopicMessage> items;
+                for (auto &msg : msgs)
+                    items.push_back(TopicMessage(key, msg));
+                return publishBatch(conn, items);
+            }
+            // 异步批量发布: 确认结果通过回调通知
+            // 拆成多个请求时, 所有请求都有了结果以后回调一次, 全部成功才算成功
+            bool publishBatch(const BaseConnection::ptr &conn, const std::vector<TopicMessage> &msgs, const PublishCallback &cb)
+            {
+                auto batches = TopicRequest::splitBatch(msgs);
+                if (batches.size() == 1)
+                    return request(conn, newBatchRequest(batches.front()), cb);
+                struct Pending
+                {
+                    std::atomic<size_t> remaining;
+                    std::atomic<bool> ok;
+                };
+                auto pending = std::make_shared<Pending>();
+                pending->remaining = batches.size();
+                pending->ok = true;
+                ResultCallback done = [pending, cb](bool ok)
+                {
+                    if (!ok)
+                        pending->ok = false;
+                    if (--pending->remaining == 0 && cb)
+                        cb(pending->ok);
+                };
+                bool ret = true;
+                for (auto &batch : batches)
+                {
+                    if (request(conn, newBatchRequest(batch), done) == false)
+                    {
+                        ret = false;
+                        done(false); // 没有发出去的请求不会有回调
+                    }
+                }
+                return ret;
+            }
+            // 发布二进制消息: 内容按原样传输(不需要 base64 编码), 服务端不解析内容直接转发
+            bool publishBinary(const BaseConnection::ptr &conn, const std::string &key, const char *data, size_t len)
+            {
+                BaseMessage::ptr msg_rsp;
+                if (_requestor->send(conn, newBinaryMessage(key, data, len), msg_rsp) == false)
+                {
+                    ERR_LOG("主题操作, 请求处理失败");
+                    return false;
+                }
+                return checkResponse(msg_rsp);
+            }
+            // 异步发布二进制消息: 确认结果通过回调通知
+            bool publishBinary(const BaseConnection::ptr &conn, const std::string &key, const char *data, size_t len, const PublishCallback &cb)
+            {
+                return request(conn, newBinaryMessage(key, data, len), cb);
+            }
+            bool publishBinaryNoAck(const BaseConnection::ptr &conn, const std::string &key, const char *data, size_t len)
+            {
+                auto msg = newBinaryMessage(key, data, len);
+                msg->setAck(false);
+                conn->send(msg);
+                return true;
+            }
+            // 不需要确认的发布: 服务端不回复响应，发布失败(主题不存在)也不会通知发布者
+            bool publishNoAck(const BaseConnection::ptr &conn, const std::string &key, const std::string &msg)
+            {
+                auto msg_req = newRequest(key, TopicOptype::TOPIC_PUBLISH);
+                msg_req->setTopicMsg(msg);
+                msg_req->setAck(false);
+                conn->send(msg_req);
+                return true;
+            }
             // 接收并处理 “来自服务端的发布消息” 的回调接口, 用于消息接收客户端
             void onPublish(const BaseConnection::ptr &conn, const TopicRequest::ptr &msg_req)
             {
                 // 1. 确保收到的是: “发布的主题消息”
                 auto optype = msg_req->optype();
+                if (optype == TopicOptype::TOPIC_PUBLISH_BATCH)
+                {
+                    // 批量消息: 按顺序逐条交给回调, 序号依次递增
+                    uint64_t seq = msg_req->seq();
+                    for (auto &item : msg_req->topicMsgs())
+                        deliver(item.first, item.second, seq++);
+                    return;
+                }
                 if (optype != TopicOptype::TOPIC_PUBLISH)
                 {
                     ERR_LOG("收到了错误类型的主题操作");
@@ -57,28 +269,96 @@ namespace TrRpc
                 // 2. 取出主题名称，和消息内容
                 std::string topic_key = msg_req->topickey();
                 std::string topic_msg = msg_req->topicMsg();
-                // 3. 通过主题名称，找到对应的回调函数进行处理
-                auto callback = getSubscribe(topic_key);
-                if (!callback)
+                deliver(topic_key, topic_msg, msg_req->seq());
+            }
+            // 3. 通过主题名称，找到对应的回调函数进行处理(直接订阅的 和 匹配的通配订阅各调用一次)
+            void deliver(const std::string &topic_key, const std::string &topic_msg, uint64_t seq)
+            {
+                auto callbacks = getSubscribes(topic_key, seq);
+                if (callbacks.empty())
+                {
+                    ERR_LOG("收到了 %s 主题消息，但是该消息无主题处理回调！", topic_key.c_str());
+                    return;
+                }
+                if (_executor)
+                {
+                    _executor->submit(topic_key, [callbacks, topic_key, topic_msg]()
+                                      {
+                                          for (auto &callback : callbacks)
+                                              callback.call(topic_key, topic_msg.data(), topic_msg.size(), &topic_msg); });
+                    return;
+                }
+                for (auto &callback : callbacks)
+                    callback.call(topic_key, topic_msg.data(), topic_msg.size(), &topic_msg);
+            }
+            // 收到二进制消息: 把消息内部的内容直接交给回调(交给执行器时由任务持有消息对象)
+            void onBinaryPublish(const BaseConnection::ptr &conn, const BinaryTopicMessage::ptr &msg)
+            {
+                std::string topic_key = msg->topickey();
+                auto callbacks = getSubscribes(topic_key, msg->seq());
+                if (callbacks.empty())
                 {
                     ERR_LOG("收到了 %s 主题消息，但是该消息无主题处理回调！", topic_key.c_str());
                     return;
                 }
-                return callback(topic_key, topic_msg);
+                if (_executor)
+                {
+                    _executor->submit(topic_key, [callbacks, topic_key, msg]()
+                                      {
+                                          for (auto &callback : callbacks)
+                                              callback.call(topic_key, msg->data(), msg->size(), nullptr); });
+                    return;
+                }
+                for (auto &callback : callbacks)
+                    callback.call(topic_key, msg->data(), msg->size(), nullptr);
             }
             // 针对不同操作生成不同的 Request 发送，并判断 请求是否处理成功
             bool commonRequest(const BaseConnection::ptr &conn, const std::string &key, const TopicOptype &optype, const std::string &msg = "")
             {
                 // 1. 组织请求
+                auto msg_req = newRequest(key, optype);
+                if (optype == TopicOptype::TOPIC_PUBLISH)
+                {
+                    msg_req->setTopicMsg(msg);
+                }
+                return request(conn, msg_req);
+            }
+            TopicRequest::ptr newBatchRequest(const std::vector<TopicMessage> &msgs)
+            {
+                // 整个请求的主题名称只用于日志, 各条消息的主题在消息列表中
+                auto msg_req = newRequest(msgs.empty() ? std::string() : msgs.front().first, TopicOptype::TOPIC_PUBLISH_BATCH);
+                msg_req->setTopicMsgs(msgs);
+                return msg_req;
+            }
+            BinaryTopicMessage::ptr newBinaryMessage(const std::string &key, const char *data, size_t len)
+            {
+                auto msg = MessageFactory::create<BinaryTopicMessage>();
+                msg->setId(UUid::uuid());
+                msg->setMtype(MType::REQ_TOPIC_BINARY);
+                msg->setPayload(key, data, len);
+                return msg;
+            }
+            TopicRequest::ptr newCreateRequest(const std::string &key, OverflowPolicy policy, size_t retain, bool durable)
+            {
+                auto msg_req = newRequest(key, TopicOptype::TOPIC_CREATE);
+                msg_req->setOverflow(policy);
+                if (retain > 0)
+                    msg_req->setRetain(retain);
+                if (durable)
+                    msg_req->setDurable(true);
+                return msg_req;
+            }
+            TopicRequest::ptr newRequest(const std::string &key, const TopicOptype &optype)
+            {
                 auto msg_req = MessageFactory::create<TopicRequest>();
                 msg_req->setId(UUid::uuid());
                 msg_req->setMtype(MType::REQ_TOPIC);
                 msg_req->setOptype(optype);
                 msg_req->setTopicKey(key);
-                if (optype == TopicOptype::TOPIC_PUBLISH)
-                {
-                    msg_req->setTopicMsg(msg);
-                }
+                return msg_req;
+            }
+            bool request(const BaseConnection::ptr &conn, const TopicRequest::ptr &msg_req)
+            {
                 // 2. 发送请求, 等待响应
                 // BaseMessage 抽象类不能被实例化，但是可以先声明指针，后续让它指向派生类实例
                 BaseMessage::ptr msg_rsp;
@@ -88,6 +368,22 @@ namespace TrRpc
                     ERR_LOG("主题操作, 请求处理失败");
                     return false;
                 }
+                return checkResponse(msg_rsp);
+            }
+            // 异步发送请求: 收到响应后在连接的 I/O 线程中回调处理结果
+            bool request(const BaseConnection::ptr &conn, const BaseMessage::ptr &msg_req, const ResultCallback &cb)
+            {
+                Requestor::RequestCallback rsp_cb = [cb](const BaseMessage::ptr &msg_rsp)
+                {
+                    bool ok = checkResponse(msg_rsp);
+                    if (cb)
+                        cb(ok);
+                };
+                return _requestor->send(conn, msg_req, rsp_cb);
+            }
+            // 检查主题操作的响应是否成功
+            static bool checkResponse(const BaseMessage::ptr &msg_rsp)
+            {
                 auto topic_rsp = std::dynamic_pointer_cast<TopicResponse>(msg_rsp);
                 if (topic_rsp == nullptr)
                 {
@@ -101,31 +397,85 @@ namespace TrRpc
                 }
                 return true;
             }
+            // 一个订阅的回调: 以字符串 或者 以字节视图接收, 两者只设置一个
+            struct Subscription
+            {
+                SubCallback text;
+                BinaryCallback binary;
+                // text: 收到的是普通消息时为消息字符串(以字符串接收时不需要再拷贝一次), 二进制消息为空
+                void call(const std::string &key, const char *data, size_t len, const std::string *text_msg) const
+                {
+                    if (binary)
+                        binary(key, data, len);
+                    else if (text_msg)
+                        this->text(key, *text_msg);
+                    else
+                        this->text(key, std::string(data, len));
+                }
+            };
             // 提供便捷的操作 _topic_callbacks 的接口
             void addSubscribe(const std::string &key, const SubCallback &cb)
+            {
+                Subscription subscription;
+                subscription.text = cb;
+                addSubscribe(key, subscription);
+            }
+            void addSubscribe(const std::string &key, const Subscription &subscription)
             {
                 std::unique_lock<std::mutex> lock(_mutex);
-                _topic_callbacks.emplace(key, cb);
+                if (TopicName::isPattern(key))
+                    _pattern_callbacks.emplace(key, subscription);
+                else
+                    _topic_callbacks.emplace(key, subscription);
             }
             void delSubscribe(const std::string &key)
             {
                 std::unique_lock<std::mutex> lock(_mutex);
                 _topic_callbacks.erase(key);
+                _pattern_callbacks.erase(key);
             }
-            // 查找某个主题的回调函数
+            // 查找某个主题的回调函数(以字节视图接收的订阅返回空)
             const SubCallback getSubscribe(const std::string &key)
             {
                 std::unique_lock<std::mutex> lock(_mutex);
                 auto it = _topic_callbacks.find(key);
                 if (it == _topic_callbacks.end())
                     return SubCallback();
-                return it->second;
+                return it->second.text;
+            }
+            // 收到的某个主题的最后一条消息的序号(还没收到过时为 0)
+            uint64_t lastSeq(const std::string &key)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto it = _last_seq.find(key);
+                return it == _last_seq.end() ? 0 : it->second;
+            }
+            // 收到某个主题的消息时要调用的所有回调: 直接订阅的 + 名称匹配的通配订阅
+            // seq 不为 0 时顺便记录该主题收到的最后一条消息的序号
+            std::vector<Subscription> getSubscribes(const std::string &key, uint64_t seq = 0)
+            {
+                std::vector<Subscription> result;
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (seq > 0)
+                    _last_seq[key] = seq;
+                auto it = _topic_callbacks.find(key);
+                if (it != _topic_callbacks.end())
+                    result.push_back(it->second);
+                for (auto &pattern : _pattern_callbacks)
+                {
+                    if (TopicName::match(pattern.first, key))
+                        result.push_back(pattern.second);
+                }
+                return result;
             }
 
         private:
             std::mutex _mutex;
-            std::unordered_map<std::string, SubCallback> _topic_callbacks; // 管理: 收到不同主题消息后的 不同回调处理函数
+            std::unordered_map<std::string, Subscription> _topic_callbacks;   // 管理: 收到不同主题消息后的 不同回调处理函数
+            std::unordered_map<std::string, Subscription> _pattern_callbacks; // 通配订阅的回调
+            std::unordered_map<std::string, uint64_t> _last_seq;           // 每个主题收到的最后一条消息的序号
             Requestor::ptr _requestor;                                     // 给客户端发请求要用这个对象的特殊send接口
+            OrderedExecutor::ptr _executor;                                // 执行订阅回调, 为空时在 I/O 线程中直接回调
         };
     }
 }
\ No newline at end of file
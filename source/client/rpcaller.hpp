@@ -3,6 +3,7 @@
 #include "../common/message.hpp"
 #include <unordered_map>
 #include "requestor.hpp"
+#include "future.hpp"
 #include <future>
 
 namespace TrRpc
@@ -17,6 +18,9 @@ namespace TrRpc
             using ptr = std::shared_ptr<RpcCaller>;
             using JsonAsyncResponse = std::future<Json::Value>;                    // 异步调用的返回结果
             using JsonResponseCallback = std::function<void(const Json::Value &)>; // 异步回调的函数类型
+            // 带错误码的异步回调: 调用出错时也会回调(rcode 不是 RCODE_OK, result 为空)
+            using JsonResultCallback = std::function<void(RCode rcode, const Json::Value &result)>;
+            using JsonFuture = Future<Json::Value>; // 可以组合的 future: 在收到响应的线程中完成, 支持 then / whenAll / whenAny
             // 传入的原因是：让多个rpccaller 共用一个 requestor （请求管理模块），没必要为每个caller都创建新的
             RpcCaller(const Requestor::ptr req) : _requestor(req) {}
 
@@ -99,6 +103,56 @@ namespace TrRpc
                 // 不需要获取响应了，因为是结果回调处理
                 return true;
             }
+            // 通过可以组合的 future 获取结果: 出错时(包括请求发送失败) future 以对应的错误码完成
+            bool call(const BaseConnection::ptr &conn, const std::string &method, const Json::Value &params, JsonFuture &result)
+            {
+                Promise<Json::Value> promise;
+                result = promise.future();
+                return call(conn, method, params, promise);
+            }
+            // 收到响应时完成 promise: Requestor 在 I/O 线程中直接设置结果, 不经过回调(不需要为回调分配 std::function)
+            bool call(const BaseConnection::ptr &conn, const std::string &method, const Json::Value &params, const Promise<Json::Value> &promise)
+            {
+                auto req = MessageFactory::create<RpcRequest>();
+                req->setId(UUid::uuid());
+                req->setMethod(method);
+                req->setMtype(MType::REQ_RPC);
+                req->setParams(params);
+                if (_requestor->send(conn, req, promise) == false)
+                {
+                    ERR_LOG("发送 Rpc 请求失败");
+                    promise.setError(RCode::RCODE_INTERNAL_ERROR);
+                    return false;
+                }
+                return true;
+            }
+            // 带错误码的异步回调
+            bool call(const BaseConnection::ptr &conn, const std::string &method, const Json::Value &params, const JsonResultCallback &cb)
+            {
+                auto req = MessageFactory::create<RpcRequest>();
+                req->setId(UUid::uuid());
+                req->setMethod(method);
+                req->setMtype(MType::REQ_RPC);
+                req->setParams(params);
+                Requestor::RequestCallback req_cb = [cb](const BaseMessage::ptr &rsp_msg)
+                {
+                    auto rpc_rsp_msg = std::dynamic_pointer_cast<RpcResponse>(rsp_msg);
+                    if (rpc_rsp_msg == nullptr)
+                    {
+                        ERR_LOG("rpc响应, 向下类型转换失败");
+                        return cb(RCode::RCODE_INVALID_MSG, Json::Value());
+                    }
+                    if (rpc_rsp_msg->rcode() != RCode::RCODE_OK)
+                        return cb(rpc_rsp_msg->rcode(), Json::Value());
+                    cb(RCode::RCODE_OK, rpc_rsp_msg->result());
+                };
+                if (_requestor->send(conn, req, req_cb) == false)
+                {
+                    ERR_LOG("发送异步回调 Rpc请求错误");
+                    return false;
+                }
+                return true;
+            }
 
         private:
             void Callback(std::shared_ptr<std::promise<Json::Value>> result, const BaseMessage::ptr &rsp_msg)
@@ -91,12 +91,26 @@ namespace TrRpc
         {
             _cb_message = cb;
         }
+        // 空闲超时(秒): 连接超过这么久没有收到任何数据(包括心跳)就主动关闭，0 表示不检测; 需要在 start 之前设置
+        virtual void setIdleTimeout(int sec)
+        {
+            _idle_timeout = sec;
+        }
+        // I/O 线程数: 0 表示所有连接都在主 loop 中处理; 需要在 start 之前设置
+        virtual void setThreadNum(int num)
+        {
+            _thread_num = num;
+        }
         virtual void start() = 0;
+        // 在服务端的主事件循环中每隔 interval 秒执行一次 task
+        virtual void runEvery(double interval, const std::function<void()> &task) = 0;
 
     protected: // 子类能访问，类外不能访问
         ConnectionCallback _cb_connection;
         CloseCallback _cb_close;
         MessageCallback _cb_message;
+        int _idle_timeout = 30;
+        int _thread_num = 0;
     };
 
     class BaseClient
@@ -116,16 +130,31 @@ namespace TrRpc
         {
             _cb_message = cb;
         }
+        // 心跳间隔 和 空闲超时(秒)，0 表示关闭对应功能; 连接之后设置也立即生效
+        virtual void setHeartbeat(int interval, int idle_timeout)
+        {
+            _heartbeat_interval = interval;
+            _idle_timeout = idle_timeout;
+        }
         // 也有连接
-        virtual void connect() = 0;                         // 建立连接
+        virtual void connect() = 0;                         // 建立连接(阻塞到连接建立完成)
+        virtual void asyncConnect() = 0;                    // 发起连接后立即返回，连接建立后调用连接回调
         virtual void shutdown() = 0;                        // 关闭连接
         virtual bool send(const BaseMessage::ptr &msg) = 0; // 发送数据
         virtual BaseConnection::ptr connection() = 0;       // 获取与服务器的连接对象 conn, 便于把数据发回去
         virtual bool connected() = 0;                       // 判断连接是否"正常"
+        // 在客户端自己的事件循环中每隔 interval 秒执行一次 task(随客户端一起销毁)
+        virtual void runEvery(double interval, const std::function<void()> &task) = 0;
+        // 在客户端自己的事件循环中 delay 秒后执行一次 task
+        virtual void runAfter(double delay, const std::function<void()> &task) = 0;
+        // 当前线程是否是客户端自己的事件循环线程(客户端不能在这个线程中销毁)
+        virtual bool inLoopThread() = 0;
 
     protected: // 子类能访问，类外不能访问
         ConnectionCallback _cb_connection;
         CloseCallback _cb_close;
         MessageCallback _cb_message;
+        int _heartbeat_interval = 10;
+        int _idle_timeout = 30;
     };
 }
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include <random>
 #include <atomic>
 #include <iomanip>
+#include <vector>
 
 // 宏不受命名空间影响
 namespace TrRpc
@@ -117,4 +118,62 @@ namespace TrRpc
         }
     };
 
+    // 主题名称: 用 '.' 分隔成多层, 例如 market.sh600000.ticks
+    // 订阅时可以使用通配符: '*' 匹配任意一层, '#' 匹配剩下的任意多层(包括 0 层, 只能是最后一层)
+    class TopicName
+    {
+    public:
+        static std::vector<std::string> split(const std::string &name)
+        {
+            std::vector<std::string> levels;
+            size_t start = 0;
+            while (true)
+            {
+                size_t pos = name.find('.', start);
+                if (pos == std::string::npos)
+                {
+                    levels.push_back(name.substr(start));
+                    return levels;
+                }
+                levels.push_back(name.substr(start, pos - start));
+                start = pos + 1;
+            }
+        }
+        // 是否包含通配符
+        static bool isPattern(const std::string &name)
+        {
+            for (auto &level : split(name))
+            {
+                if (level == "*" || level == "#")
+                    return true;
+            }
+            return false;
+        }
+        // 通配订阅是否合法: 每一层都不为空, '#' 只能出现在最后一层
+        static bool validPattern(const std::string &pattern)
+        {
+            auto levels = split(pattern);
+            for (size_t i = 0; i < levels.size(); i++)
+            {
+                if (levels[i].empty() || (levels[i] == "#" && i + 1 != levels.size()))
+                    return false;
+            }
+            return true;
+        }
+        // 具体的主题名称 name 是否匹配 pattern
+        static bool match(const std::string &pattern, const std::string &name)
+        {
+            auto p = split(pattern), n = split(name);
+            size_t i = 0;
+            for (; i < p.size(); i++)
+            {
+                if (p[i] == "#")
+                    return true;
+                if (i == n.size() || (p[i] != "*" && p[i] != n[i]))
+                    return false;
+            }
+            return i == n.size();
+        }
+    };
+
 }
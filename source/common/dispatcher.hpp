@@ -47,18 +47,23 @@ namespace TrRpc
         // 提供给 client/server 设置的 收到任何消息的入口，  (内部根据具体的消息类型调用到上面 registerHandler 注册好的不同的回调函数)
         void OnMessage(BaseConnection::ptr &conn, BaseMessage::ptr &msg)
         {
-            std::unique_lock<std::mutex> lock(_mutex);
-            MType mtype = msg->mtype();
-            auto it = _handlers.find(mtype);
-            // 没找到，理论上是不存在的，因为服务端和客户端都是我们写的 (除非遇到恶意客户端访问未知方法)
-            if(it == _handlers.end()) 
+            Callback::ptr cb;
             {
-                ERR_LOG("收到未知消息类型: %d", (int)mtype);
-                conn->shutdown();
-                return;
+                // 锁只保护查表，业务处理不能放在锁里: 否则多个 I/O 线程上的请求会被串行处理
+                std::unique_lock<std::mutex> lock(_mutex);
+                MType mtype = msg->mtype();
+                auto it = _handlers.find(mtype);
+                // 没找到，理论上是不存在的，因为服务端和客户端都是我们写的 (除非遇到恶意客户端访问未知方法)
+                if(it == _handlers.end()) 
+                {
+                    ERR_LOG("收到未知消息类型: %d", (int)mtype);
+                    conn->shutdown();
+                    return;
+                }
+                cb = it->second;
             }
             // 通过父类指针调用到不同子类的 OnMessage 方法
-            it->second->OnMessage(conn, msg);
+            cb->OnMessage(conn, msg);
         }
     private:
         std::mutex _mutex; // 用来给操作 _handlers 的时候加锁
@@ -15,6 +15,24 @@ namespace TrRpc
 #define KEY_HOST_PORT "port"
 #define KEY_RCODE "rcode"          // 服务完后的返回状态码
 #define KEY_RESULT "result"        // 服务完后的结果
+#define KEY_LOAD "load"            // 服务提供者的负载上报: 一个 Json对象 {inflight, qps, cpu}
+#define KEY_LOAD_INFLIGHT "inflight"
+#define KEY_LOAD_QPS "qps"
+#define KEY_LOAD_CPU "cpu"
+#define KEY_WEIGHT "weight"        // 注册中心根据负载算出来的主机权重(服务发现响应 / 上线通知中携带)
+#define KEY_VERSION "version"      // 注册中心的版本号: 每发生一次服务上下线就加 1
+#define KEY_PREV_VERSION "prev_version" // 增量通知中: 上一条发给同一发现者的增量通知的版本号
+#define KEY_CHANGES "changes"      // 增量通知中: 一段时间内积攒的服务上下线变化(数组)
+#define KEY_METHODS "methods"      // 批量服务注册: 一个主机一次注册的所有方法(数组)
+#define KEY_OVERFLOW "overflow"    // 创建主题时: 订阅者发送队列满了之后的处理策略
+#define KEY_ACK "ack"              // 发布消息时: 是否需要服务端回复响应(不携带时需要)
+#define KEY_TOPIC_MSGS "topic_msgs" // 批量发布: 多条消息(数组), 每条是 {topic_key, topic_msg}
+#define KEY_RETAIN "retain"        // 创建主题时: 服务端为这个主题保留最近多少条消息(用于重放), 0 表示不保留
+#define KEY_SEQ "seq"              // 推送给订阅者的消息: 消息在主题中的序号(批量消息为第一条的序号); 订阅时: 从这个序号开始重放
+#define KEY_DURABLE "durable"      // 创建主题时: 消息是否写入服务端的持久化日志
+#define KEY_CONSUMER "consumer"    // 持久化主题的消费者名称: 提交消费位置 / 订阅时从上次提交的位置继续
+#define KEY_GROUP "group"          // 订阅 / 取消订阅时: 消费组名称, 同一组的订阅者合起来每条消息只收到一次
+#define KEY_BALANCE "balance"      // 加入消费组时: 组内挑选接收者的策略(由组内第一个订阅者决定)
 
 // 下面都是 Request 和 Response 中 针对上面不同核心业务数据的各种 "值"
 // 如: method 数据的类型就是 string (用string 来描述一个方法, 因为到时候直接用函数名对应)
@@ -27,7 +45,10 @@ namespace TrRpc
         REQ_TOPIC,
         RSP_TOPIC,
         REQ_SERVICE,
-        RSP_SERVICE
+        RSP_SERVICE,
+        REQ_HEARTBEAT, // 心跳探测: 客户端定期发送
+        RSP_HEARTBEAT, // 心跳应答: 服务端收到探测后立即回复
+        REQ_TOPIC_BINARY // 二进制主题消息的发布 / 推送: 内容是原始字节, 不经过 Json 编码; 发布的响应仍然是 RSP_TOPIC
     };
 
     enum class RCode
@@ -67,7 +88,8 @@ namespace TrRpc
     enum class RType
     {
         REQ_ASYNC = 0, // 异步请求
-        REQ_CALLBACK   // 回调请求: 设置回调函数，通过回调函数对响应进行处理
+        REQ_CALLBACK,  // 回调请求: 设置回调函数，通过回调函数对响应进行处理
+        REQ_FUTURE     // rpc 请求: 收到响应时直接用结果完成可以组合的 future(client/future.hpp)
     };
 
     enum class TopicOptype
@@ -76,7 +98,24 @@ namespace TrRpc
         TOPIC_REMOVE,
         TOPIC_SUBSCRIBE,
         TOPIC_CANCEL,
-        TOPIC_PUBLISH   // 客户端给主题发布消息: 客户端到客户端不再是点对点的通信, 而是通过主题来连接的
+        TOPIC_PUBLISH,  // 客户端给主题发布消息: 客户端到客户端不再是点对点的通信, 而是通过主题来连接的
+        TOPIC_PUBLISH_BATCH, // 一次发布多条消息(可以属于不同的主题), 服务端推送给订阅者时也是批量的
+        TOPIC_COMMIT        // 持久化主题的消费者提交消费位置(seq 以及之前的消息都处理完了)
+    };
+
+    // 订阅者的发送队列满了(订阅者消费得太慢)时的处理策略, 创建主题时指定
+    enum class OverflowPolicy
+    {
+        DROP_OLDEST = 0, // 丢弃队列中最旧的消息(默认, 适合行情这类只关心最新值的数据)
+        DROP_NEWEST,     // 丢弃新来的消息
+        DISCONNECT       // 断开这个订阅者
+    };
+
+    // 消费组内每条消息交给哪个成员
+    enum class GroupBalance
+    {
+        ROUND_ROBIN = 0, // 轮流(默认)
+        LEAST_PENDING    // 服务端发送队列中积压最少的成员
     };
 
     enum class ServiceOptype
@@ -85,6 +124,11 @@ namespace TrRpc
         SERVICE_DISCOVERY,
         SERVICE_ONLINE,
         SERVICE_OFFLINE,
+        SERVICE_LOAD,   // 服务提供者定期上报负载(不需要响应)
+        SERVICE_REPLICA_ONLINE,  // 注册中心节点之间同步: 提供者上线 / 权重变化(不需要响应)
+        SERVICE_REPLICA_OFFLINE, // 注册中心节点之间同步: 提供者下线(不需要响应)
+        SERVICE_DELTA,           // 注册中心发给发现者的增量通知: 把一段时间内的多个上下线变化合并成一条
+        SERVICE_BULK_REGISTRY,   // 批量服务注册: 一个请求注册一个主机的多个方法
         SERVICE_UNKNOW
     };
 }
\ No newline at end of file
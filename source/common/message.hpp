@@ -1,12 +1,30 @@
 #pragma once
 #include "detail.hpp"
 #include "abstract.hpp"
+#include <arpa/inet.h>
 
 // 根据不同的需求，对 Message 进行实现
 
 namespace TrRpc
 {
     typedef std::pair<std::string, int> Address; // 主机地址(ip, port)
+    const int DEFAULT_WEIGHT = 100;              // 没有负载信息时的主机权重(权重范围 1 ~ 100)
+    // 服务提供者的负载信息
+    struct LoadInfo
+    {
+        int inflight = 0; // 正在处理的请求数
+        double qps = 0;   // 最近一个上报周期内的每秒请求数
+        double cpu = 0;   // 进程 cpu 使用率(0 ~ 100, 按机器总核数归一化)
+    };
+    // 增量通知中的一个变化: 某个方法的某个主机上线(或权重变化) / 下线
+    struct ServiceChange
+    {
+        std::string method;
+        Address host;
+        ServiceOptype optype = ServiceOptype::SERVICE_ONLINE; // SERVICE_ONLINE / SERVICE_OFFLINE
+        int weight = DEFAULT_WEIGHT;
+        uint64_t version = 0; // 这个变化发生时注册中心的版本号
+    };
     // 在这里多设计一个 JsonMessage 作为父类，代表 Json类消息格式
     // 避免下面的 Request 和 Response（它们是在特定业务场景下的消息），不过进一步进行了细分
     class JsonMessage : public BaseMessage
@@ -129,6 +147,7 @@ namespace TrRpc
     };
 
     // 业务 2: 主题发布和订阅
+    using TopicMessage = std::pair<std::string, std::string>; // 批量发布中的一条消息: 主题 + 消息
     class TopicRequest : public JsonRequest
     {
     public:
@@ -150,6 +169,23 @@ namespace TrRpc
                 ERR_LOG("主题请求中: 操作方法的类型 或 操作方法的类型错误");
                 return false;
             }
+            if (_body[KEY_OPTYPE].asInt() == (int)TopicOptype::TOPIC_PUBLISH_BATCH)
+            {
+                const Json::Value &msgs = _body[KEY_TOPIC_MSGS];
+                if (msgs.isArray() == false)
+                {
+                    ERR_LOG("批量发布请求中: 消息列表不存在 或 类型错误");
+                    return false;
+                }
+                for (auto &item : msgs)
+                {
+                    if (item.isObject() == false || !item[KEY_TOPIC_KEY].isString() || !item[KEY_TOPIC_MSG].isString())
+                    {
+                        ERR_LOG("批量发布请求中: 消息格式错误");
+                        return false;
+                    }
+                }
+            }
             return true;
         }
         // 以下是对上面三个核心业务数据的设置(client)和获取(server)
@@ -178,6 +214,143 @@ namespace TrRpc
         {
             _body[KEY_TOPIC_MSG] = msg;
         }
+        // 没有携带时使用默认策略
+        OverflowPolicy overflow()
+        {
+            if (_body[KEY_OVERFLOW].isIntegral() == false)
+                return OverflowPolicy::DROP_OLDEST;
+            return (OverflowPolicy)_body[KEY_OVERFLOW].asInt();
+        }
+        void setOverflow(OverflowPolicy policy)
+        {
+            _body[KEY_OVERFLOW] = (int)policy;
+        }
+        size_t retain()
+        {
+            return _body[KEY_RETAIN].isIntegral() ? _body[KEY_RETAIN].asUInt() : 0;
+        }
+        void setRetain(size_t retain)
+        {
+            _body[KEY_RETAIN] = (Json::UInt)retain;
+        }
+        // 没有携带时为 0 (序号从 1 开始)
+        uint64_t seq()
+        {
+            return _body[KEY_SEQ].isIntegral() ? _body[KEY_SEQ].asUInt64() : 0;
+        }
+        void setSeq(uint64_t seq)
+        {
+            _body[KEY_SEQ] = (Json::UInt64)seq;
+        }
+        // 批量发布的消息, 按发布顺序
+        std::vector<TopicMessage> topicMsgs()
+        {
+            std::vector<TopicMessage> result;
+            const Json::Value &msgs = _body[KEY_TOPIC_MSGS];
+            for (auto &item : msgs)
+                result.push_back(TopicMessage(item[KEY_TOPIC_KEY].asString(), item[KEY_TOPIC_MSG].asString()));
+            return result;
+        }
+        void setTopicMsgs(const std::vector<TopicMessage> &msgs)
+        {
+            Json::Value array(Json::arrayValue);
+            for (auto &msg : msgs)
+            {
+                Json::Value item;
+                item[KEY_TOPIC_KEY] = msg.first;
+                item[KEY_TOPIC_MSG] = msg.second;
+                array.append(item);
+            }
+            _body[KEY_TOPIC_MSGS] = array;
+        }
+        // 网络层会断开缓冲了超过 64KB 还凑不成一条完整消息的连接(net.hpp 中的 maxDataSize)
+        // 所以一个批量发布请求(以及服务端推送的一批)中的消息序列化以后不超过 maxBatchBytes, 留出其他字段的空间
+        enum
+        {
+            maxBatchBytes = 48 * 1024
+        };
+        // 按顺序把消息拆成若干批, 每批不超过 maxBatchBytes; 一条消息本身就超过时单独一批(和单条发布一样受网络层限制)
+        static std::vector<std::vector<TopicMessage>> splitBatch(const std::vector<TopicMessage> &msgs)
+        {
+            std::vector<std::vector<TopicMessage>> batches(1);
+            size_t bytes = 0;
+            for (auto &msg : msgs)
+            {
+                size_t size = jsonSize(msg.first) + jsonSize(msg.second) + 32; // 加上字段名、引号、括号
+                if (batches.back().empty() == false && bytes + size > maxBatchBytes)
+                {
+                    batches.emplace_back();
+                    bytes = 0;
+                }
+                batches.back().push_back(msg);
+                bytes += size;
+            }
+            return batches;
+        }
+        // 字符串写成 Json 以后最多多少字节: 非 ASCII 字符会转义成 \uXXXX(每个字节最多 3 个), 控制字符 6 个
+        static size_t jsonSize(const std::string &str)
+        {
+            size_t size = 0;
+            for (unsigned char c : str)
+            {
+                if (c >= 0x80)
+                    size += 3;
+                else if (c < 0x20)
+                    size += 6;
+                else if (c == '"' || c == '\\')
+                    size += 2;
+                else
+                    size += 1;
+            }
+            return size;
+        }
+        // 不需要响应的发布(发出去就不管了)
+        bool ack()
+        {
+            if (_body[KEY_ACK].isBool() == false)
+                return true;
+            return _body[KEY_ACK].asBool();
+        }
+        void setAck(bool ack)
+        {
+            _body[KEY_ACK] = ack;
+        }
+        bool durable()
+        {
+            return _body[KEY_DURABLE].isBool() && _body[KEY_DURABLE].asBool();
+        }
+        void setDurable(bool durable)
+        {
+            _body[KEY_DURABLE] = durable;
+        }
+        // 没有携带时为空
+        std::string consumer()
+        {
+            return _body[KEY_CONSUMER].isString() ? _body[KEY_CONSUMER].asString() : std::string();
+        }
+        void setConsumer(const std::string &consumer)
+        {
+            _body[KEY_CONSUMER] = consumer;
+        }
+        // 没有携带时为空(不是消费组订阅)
+        std::string group()
+        {
+            return _body[KEY_GROUP].isString() ? _body[KEY_GROUP].asString() : std::string();
+        }
+        void setGroup(const std::string &group)
+        {
+            _body[KEY_GROUP] = group;
+        }
+        GroupBalance balance()
+        {
+            if (_body[KEY_BALANCE].isIntegral() == false)
+                return GroupBalance::ROUND_ROBIN;
+            return (GroupBalance)_body[KEY_BALANCE].asInt();
+        }
+        void setBalance(GroupBalance balance)
+        {
+            _body[KEY_BALANCE] = (int)balance;
+        }
     };
 
     class TopicResponse : public JsonResponse
@@ -202,7 +375,44 @@ namespace TrRpc
         using ptr = std::shared_ptr<ServiceRequest>;
         virtual bool check() override
         {
-            if (_body[KEY_METHOD].isNull() || !_body[KEY_METHOD].isString())
+            // 增量通知: 方法和主机都在 changes 数组的每个元素里
+            if (_body[KEY_OPTYPE].asInt() == (int)(ServiceOptype::SERVICE_DELTA))
+            {
+                if (_body[KEY_CHANGES].isArray() == false || _body[KEY_VERSION].isIntegral() == false ||
+                    _body[KEY_PREV_VERSION].isIntegral() == false)
+                {
+                    ERR_LOG("增量通知中: 变化列表 或 版本号错误");
+                    return false;
+                }
+                return true;
+            }
+            // 批量注册: 方法在 methods 数组中
+            if (_body[KEY_OPTYPE].asInt() == (int)(ServiceOptype::SERVICE_BULK_REGISTRY))
+            {
+                if (_body[KEY_METHODS].isArray() == false || _body[KEY_METHODS].empty())
+                {
+                    ERR_LOG("批量注册请求中: 方法列表不存在 或 类型错误");
+                    return false;
+                }
+                for (Json::ArrayIndex i = 0; i < _body[KEY_METHODS].size(); i++)
+                {
+                    if (_body[KEY_METHODS][i].isString() == false)
+                    {
+                        ERR_LOG("批量注册请求中: 方法类型错误");
+                        return false;
+                    }
+                }
+            }
+            // 负载上报针对的是整个主机，不需要方法字段，但必须有负载信息
+            else if (_body[KEY_OPTYPE].asInt() == (int)(ServiceOptype::SERVICE_LOAD))
+            {
+                if (_body[KEY_LOAD].isNull() || !_body[KEY_LOAD].isObject())
+                {
+                    ERR_LOG("负载上报请求中: 负载信息不存在 或 类型错误");
+                    return false;
+                }
+            }
+            else if (_body[KEY_METHOD].isNull() || !_body[KEY_METHOD].isString())
             {
                 ERR_LOG("服务注册与发现请求中: 方法不存在 或 方法类型错误");
                 return false;
@@ -235,6 +445,20 @@ namespace TrRpc
         {
             _body[KEY_METHOD] = method_name;
         }
+        // 批量注册的方法列表
+        std::vector<std::string> methods()
+        {
+            std::vector<std::string> methods;
+            for (Json::ArrayIndex i = 0; i < _body[KEY_METHODS].size(); i++)
+                methods.push_back(_body[KEY_METHODS][i].asString());
+            return methods;
+        }
+        void setMethods(const std::vector<std::string> &methods)
+        {
+            _body[KEY_METHODS] = Json::Value(Json::arrayValue);
+            for (auto &method : methods)
+                _body[KEY_METHODS].append(method);
+        }
         ServiceOptype optype()
         {
             return (ServiceOptype)_body[KEY_OPTYPE].asInt();
@@ -258,6 +482,83 @@ namespace TrRpc
             val[KEY_HOST_PORT] = host.second;
             _body[KEY_HOST] = val;
         }
+        // 上线通知中携带的主机权重(没有时按默认权重处理)
+        int weight()
+        {
+            if (_body[KEY_WEIGHT].isIntegral() == false)
+                return DEFAULT_WEIGHT;
+            return _body[KEY_WEIGHT].asInt();
+        }
+        void setWeight(int weight)
+        {
+            _body[KEY_WEIGHT] = weight;
+        }
+        LoadInfo load()
+        {
+            LoadInfo load;
+            load.inflight = _body[KEY_LOAD][KEY_LOAD_INFLIGHT].asInt();
+            load.qps = _body[KEY_LOAD][KEY_LOAD_QPS].asDouble();
+            load.cpu = _body[KEY_LOAD][KEY_LOAD_CPU].asDouble();
+            return load;
+        }
+        void setLoad(const LoadInfo &load)
+        {
+            Json::Value val;
+            val[KEY_LOAD_INFLIGHT] = load.inflight;
+            val[KEY_LOAD_QPS] = load.qps;
+            val[KEY_LOAD_CPU] = load.cpu;
+            _body[KEY_LOAD] = val;
+        }
+        // 增量通知的版本号
+        uint64_t version()
+        {
+            return _body[KEY_VERSION].asUInt64();
+        }
+        void setVersion(uint64_t version)
+        {
+            _body[KEY_VERSION] = (Json::UInt64)version;
+        }
+        uint64_t prevVersion()
+        {
+            return _body[KEY_PREV_VERSION].asUInt64();
+        }
+        void setPrevVersion(uint64_t version)
+        {
+            _body[KEY_PREV_VERSION] = (Json::UInt64)version;
+        }
+        std::vector<ServiceChange> changes()
+        {
+            std::vector<ServiceChange> changes;
+            for (Json::ArrayIndex i = 0; i < _body[KEY_CHANGES].size(); i++)
+            {
+                const Json::Value &val = _body[KEY_CHANGES][i];
+                ServiceChange change;
+                change.method = val[KEY_METHOD].asString();
+                change.host.first = val[KEY_HOST][KEY_HOST_IP].asString();
+                change.host.second = val[KEY_HOST][KEY_HOST_PORT].asInt();
+                change.optype = (ServiceOptype)val[KEY_OPTYPE].asInt();
+                change.weight = val[KEY_WEIGHT].isIntegral() ? val[KEY_WEIGHT].asInt() : DEFAULT_WEIGHT;
+                change.version = val[KEY_VERSION].asUInt64();
+                changes.push_back(change);
+            }
+            return changes;
+        }
+        void setChanges(const std::vector<ServiceChange> &changes)
+        {
+            _body[KEY_CHANGES] = Json::Value(Json::arrayValue);
+            for (auto &change : changes)
+            {
+                Json::Value val;
+                val[KEY_METHOD] = change.method;
+                val[KEY_HOST][KEY_HOST_IP] = change.host.first;
+                val[KEY_HOST][KEY_HOST_PORT] = change.host.second;
+                val[KEY_OPTYPE] = (int)change.optype;
+                if (change.optype == ServiceOptype::SERVICE_ONLINE)
+                    val[KEY_WEIGHT] = change.weight;
+                val[KEY_VERSION] = (Json::UInt64)change.version;
+                _body[KEY_CHANGES].append(val);
+            }
+        }
     };
     class ServiceResponse : public JsonResponse
     {
@@ -307,7 +608,7 @@ namespace TrRpc
         std::vector<Address> hosts()
         {
             std::vector<Address> addrs;
-            for (int i = 0; i < _body[KEY_HOST].size(); i++)
+            for (Json::ArrayIndex i = 0; i < _body[KEY_HOST].size(); i++)
             {
                 Address addr;
                 addr.first = _body[KEY_HOST][i][KEY_HOST_IP].asString();
@@ -316,17 +617,153 @@ namespace TrRpc
             }
             return addrs;
         }
-        void setHost(const std::vector<Address> &addrs)
+        // 每个主机的权重，与 hosts() 一一对应
+        std::vector<int> weights()
         {
-            for (const auto &addr : addrs)
+            std::vector<int> weights;
+            for (Json::ArrayIndex i = 0; i < _body[KEY_HOST].size(); i++)
+            {
+                const Json::Value &w = _body[KEY_HOST][i][KEY_WEIGHT];
+                weights.push_back(w.isIntegral() ? w.asInt() : DEFAULT_WEIGHT);
+            }
+            return weights;
+        }
+        // 服务发现响应中: 生成这个响应时注册中心的版本号，版本号不大于它的增量变化已经包含在响应中了
+        uint64_t version()
+        {
+            return _body[KEY_VERSION].asUInt64();
+        }
+        void setVersion(uint64_t version)
+        {
+            _body[KEY_VERSION] = (Json::UInt64)version;
+        }
+        // weights 为空时不携带权重
+        void setHost(const std::vector<Address> &addrs, const std::vector<int> &weights = std::vector<int>())
+        {
+            for (size_t i = 0; i < addrs.size(); i++)
             {
                 Json::Value host;
-                host[KEY_HOST_IP] = addr.first;
-                host[KEY_HOST_PORT] = addr.second;
+                host[KEY_HOST_IP] = addrs[i].first;
+                host[KEY_HOST_PORT] = addrs[i].second;
+                if (i < weights.size())
+                    host[KEY_WEIGHT] = weights[i];
                 _body[KEY_HOST].append(host);
             }
         }
     };
+    // 心跳消息: 只用来证明连接还活着，没有正文，不需要 Json 序列化
+    class HeartbeatMessage : public BaseMessage
+    {
+    public:
+        using ptr = std::shared_ptr<HeartbeatMessage>;
+        virtual std::string serialize() override { return std::string(); }
+        virtual bool deserialize(const std::string &) override { return true; }
+        virtual bool check() override { return true; }
+    };
+    // 已经序列化好正文的消息: 正文在多次发送之间共享，每次发送只需要设置各自的 id
+    // 用于内容经常重复的响应(例如注册中心缓存的服务发现响应)，省去每次构造 Json 和序列化的开销
+    // 只用于发送，收到的消息仍然按 mtype 构造成具体的消息对象
+    class EncodedMessage : public BaseMessage
+    {
+    public:
+        using ptr = std::shared_ptr<EncodedMessage>;
+        EncodedMessage(MType mtype, const std::shared_ptr<const std::string> &body)
+            : _body(body)
+        {
+            setMtype(mtype);
+        }
+        virtual std::string serialize() override { return *_body; }
+        virtual bool deserialize(const std::string &) override { return false; }
+        virtual bool check() override { return true; }
+
+    private:
+        std::shared_ptr<const std::string> _body;
+    };
+    // 二进制主题消息: 内容按原样放在一个很小的头部之后, 不需要 base64, 发布、推送、接收时也没有 Json 的转义和解析
+    // 正文: |--flags(2)--|--keylen(2)--|--seq(8)--|--key--|--payload--|  (整数都是网络字节序)
+    // 服务端只读头部和主题名称, 推送时只改写 seq 字段, 内容原样转发
+    class BinaryTopicMessage : public BaseMessage
+    {
+    public:
+        using ptr = std::shared_ptr<BinaryTopicMessage>;
+        BinaryTopicMessage() : _raw(headerLen, '\0')
+        {
+            setAck(true);
+        }
+        virtual std::string serialize() override { return _raw; }
+        virtual bool deserialize(const std::string &msg) override
+        {
+            _raw = msg;
+            return check();
+        }
+        virtual bool check() override
+        {
+            if (_raw.size() < headerLen || _raw.size() < headerLen + keyLen())
+            {
+                ERR_LOG("二进制主题消息: 长度不足");
+                return false;
+            }
+            return true;
+        }
+        // 设置主题名称和内容(任意字节)
+        void setPayload(const std::string &key, const char *data, size_t len)
+        {
+            uint16_t keylen = htons((uint16_t)key.size());
+            _raw.resize(headerLen);
+            _raw.reserve(headerLen + key.size() + len);
+            memcpy(&_raw[2], &keylen, 2);
+            _raw.append(key);
+            _raw.append(data, len);
+        }
+        std::string topickey()
+        {
+            return _raw.substr(headerLen, keyLen());
+        }
+        // 内容: 指向消息内部, 消息对象存在期间有效
+        const char *data()
+        {
+            return _raw.data() + headerLen + keyLen();
+        }
+        size_t size()
+        {
+            return _raw.size() - headerLen - keyLen();
+        }
+        // 发布时是否需要服务端回复响应
+        bool ack()
+        {
+            return (_raw[1] & flagAck) != 0;
+        }
+        void setAck(bool ack)
+        {
+            _raw[1] = ack ? (_raw[1] | flagAck) : (_raw[1] & ~flagAck);
+        }
+        uint64_t seq()
+        {
+            uint64_t seq = 0;
+            for (int i = 0; i < 8; i++)
+                seq = (seq << 8) | (uint8_t)_raw[4 + i];
+            return seq;
+        }
+        void setSeq(uint64_t seq)
+        {
+            for (int i = 7; i >= 0; i--, seq >>= 8)
+                _raw[4 + i] = (char)(seq & 0xff);
+        }
+
+    private:
+        enum
+        {
+            headerLen = 12,
+            flagAck = 1
+        };
+        size_t keyLen()
+        {
+            uint16_t keylen = 0;
+            memcpy(&keylen, &_raw[2], 2);
+            return ntohs(keylen);
+        }
+        std::string _raw; // 整个正文
+    };
     // 设计一个消息对象的生产工厂(返回指向子类的基类指针)
     // 提供统一接口，避免一直 new 不同的消息对象
     class MessageFactory
@@ -350,6 +787,11 @@ namespace TrRpc
                 return std::make_shared<ServiceRequest>();
             case MType::RSP_SERVICE:
                 return std::make_shared<ServiceResponse>();
+            case MType::REQ_HEARTBEAT:
+            case MType::RSP_HEARTBEAT:
+                return std::make_shared<HeartbeatMessage>();
+            case MType::REQ_TOPIC_BINARY:
+                return std::make_shared<BinaryTopicMessage>();
             }
             return BaseMessage::ptr();
         }
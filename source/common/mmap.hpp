@@ -0,0 +1,125 @@
+#pragma once
+#include "detail.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+// 内存映射文件: 把文件直接映射到进程地址空间, 读写文件就像读写内存一样
+// 用于注册中心快照等需要落盘的数据(避免 read/write 的额外拷贝)
+namespace TrRpc
+{
+    class MmapFile
+    {
+    public:
+        using ptr = std::shared_ptr<MmapFile>;
+        MmapFile() : _fd(-1), _data(nullptr), _size(0), _writable(false) {}
+        ~MmapFile() { close(); }
+        MmapFile(const MmapFile &) = delete;
+        MmapFile &operator=(const MmapFile &) = delete;
+
+        // 只读映射整个文件(文件为空时映射失败)
+        bool openRead(const std::string &path)
+        {
+            close();
+            _fd = ::open(path.c_str(), O_RDONLY);
+            if (_fd < 0)
+                return false; // 文件不存在是正常情况，由调用者决定是否打印日志
+            struct stat st;
+            if (::fstat(_fd, &st) < 0 || st.st_size == 0)
+            {
+                close();
+                return false;
+            }
+            return map(st.st_size, false);
+        }
+        // 读写映射: 文件不存在则创建，并把文件大小调整为 size
+        // 调整大小后用 posix_fallocate 真正分配磁盘空间: 只 ftruncate 得到的是稀疏文件, 磁盘满时写映射内存会收到 SIGBUS
+        // 空间不够(ENOSPC)等分配失败时打开失败, 由调用者处理
+        bool openWrite(const std::string &path, size_t size)
+        {
+            close();
+            _fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (_fd < 0)
+            {
+                ERR_LOG("打开文件 %s 失败: %s", path.c_str(), strerror(errno));
+                return false;
+            }
+            if (::ftruncate(_fd, size) < 0)
+            {
+                ERR_LOG("调整文件 %s 大小失败: %s", path.c_str(), strerror(errno));
+                close();
+                return false;
+            }
+            int err = ::posix_fallocate(_fd, 0, size);
+            if (err != 0)
+            {
+                ERR_LOG("为文件 %s 分配 %zu 字节的磁盘空间失败: %s", path.c_str(), size, strerror(err));
+                close();
+                return false;
+            }
+            return map(size, true);
+        }
+        // 调整文件大小并重新映射(之前通过 data() 拿到的指针全部失效)
+        bool resize(size_t size)
+        {
+            if (_fd < 0 || !_writable)
+                return false;
+            unmap();
+            if (::ftruncate(_fd, size) < 0)
+            {
+                ERR_LOG("调整文件大小失败: %s", strerror(errno));
+                return false;
+            }
+            return map(size, true);
+        }
+        // 把修改刷到磁盘
+        bool sync()
+        {
+            if (_data == nullptr || !_writable)
+                return false;
+            return ::msync(_data, _size, MS_SYNC) == 0;
+        }
+        void close()
+        {
+            unmap();
+            if (_fd >= 0)
+                ::close(_fd);
+            _fd = -1;
+        }
+        char *data() { return _data; }
+        size_t size() { return _size; }
+
+    private:
+        bool map(size_t size, bool writable)
+        {
+            int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+            void *addr = ::mmap(nullptr, size, prot, MAP_SHARED, _fd, 0);
+            if (addr == MAP_FAILED)
+            {
+                ERR_LOG("mmap 失败: %s", strerror(errno));
+                close();
+                return false;
+            }
+            _data = static_cast<char *>(addr);
+            _size = size;
+            _writable = writable;
+            return true;
+        }
+        void unmap()
+        {
+            if (_data != nullptr)
+                ::munmap(_data, _size);
+            _data = nullptr;
+            _size = 0;
+        }
+
+    private:
+        int _fd;
+        char *_data;
+        size_t _size;
+        bool _writable;
+    };
+}
@@ -13,6 +13,7 @@
 #include <muduo/net/EventLoopThread.h>
 #include <muduo/net/EventLoop.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <mutex>
 #include <arpa/inet.h>
 
@@ -164,11 +165,93 @@ namespace TrRpc
         {
             return _conn->connected();
         }
+        const muduo::net::TcpConnectionPtr &tcpConnection()
+        {
+            return _conn;
+        }
 
     private:
         BaseProtocol::ptr _protocol;        // 但是没有必要每个 connection 都配置一个不同的protocol
         muduo::net::TcpConnectionPtr _conn; // 基于muduo库的conn实现
     };
+    // 客户端一侧的连接: 在 MuduoClient 构造时就存在，上层可以在连接建立之前拿到它并发送消息
+    // 连接建立前发送的消息，序列化后先缓存起来(总字节数有上限)，连接建立后在 loop 线程中按顺序发出
+    class MuduoClientConnection : public BaseConnection
+    {
+    public:
+        using ptr = std::shared_ptr<MuduoClientConnection>;
+        MuduoClientConnection(const BaseProtocol::ptr &protocol, size_t max_pending)
+            : _protocol(protocol), _max_pending(max_pending), _pending_bytes(0), _closed(false)
+        {
+        }
+        virtual void send(const BaseMessage::ptr &msg) override
+        {
+            trySend(msg);
+        }
+        // 发送或缓存消息, 连接已关闭 或 缓存已满时返回 false
+        bool trySend(const BaseMessage::ptr &msg)
+        {
+            std::string data = _protocol->serialize(msg);
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_conn)
+            {
+                _conn->send(data);
+                return true;
+            }
+            if (_closed)
+            {
+                ERR_LOG("连接已经断开，发送数据失败！");
+                return false;
+            }
+            if (_pending_bytes + data.size() > _max_pending)
+            {
+                ERR_LOG("连接尚未建立, 且发送缓存已满(%zu 字节), 消息被丢弃", _max_pending);
+                return false;
+            }
+            _pending_bytes += data.size();
+            _pending.push_back(std::move(data));
+            return true;
+        }
+        virtual void shutdown() override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_conn)
+                _conn->shutdown();
+        }
+        virtual bool connected() override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _conn && _conn->connected();
+        }
+        // 连接建立(loop 线程): 先把缓存的消息按顺序发出去, 之后的消息直接发送
+        void attach(const muduo::net::TcpConnectionPtr &conn)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for (auto &data : _pending)
+                conn->send(data);
+            _pending.clear();
+            _pending_bytes = 0;
+            _conn = conn;
+        }
+        // 连接断开: 丢弃未发出的消息，之后的发送都会失败
+        void detach()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _conn.reset();
+            _closed = true;
+            _pending.clear();
+            _pending_bytes = 0;
+        }
+
+    private:
+        std::mutex _mutex;
+        BaseProtocol::ptr _protocol;
+        size_t _max_pending;                // 连接建立前最多缓存多少字节
+        size_t _pending_bytes;
+        std::vector<std::string> _pending;  // 连接建立前缓存的已序列化消息
+        bool _closed;
+        muduo::net::TcpConnectionPtr _conn; // 连接建立后才有
+    };
     class ConnectionFactory
     {
     public:
@@ -179,24 +262,121 @@ namespace TrRpc
         }
     };
 
+    // 时间轮: 用来踢掉长时间没有数据往来的连接(如: 对端崩溃留下的半开连接)
+    // 一个 loop 一个时间轮, 只在所属的 loop 线程中使用, 所以不需要加锁
+    // 轮子有 n 个桶，每秒转动一格；连接每次活跃都会把自己的 Entry 放进最新的桶里
+    // 一个 Entry 在 n 秒内都没有被再放进新桶时，最后一个引用随旧桶一起被清掉，析构时关闭连接
+    class TimingWheel
+    {
+    public:
+        using ptr = std::shared_ptr<TimingWheel>;
+        TimingWheel(int idle_timeout)
+            : _buckets(idle_timeout > 0 ? idle_timeout : 1), _cur(0) {}
+        // 连接建立 / 收到数据时调用
+        void touch(const muduo::net::TcpConnectionPtr &conn)
+        {
+            Entry::ptr entry;
+            auto it = _entries.find(conn.get());
+            if (it != _entries.end())
+                entry = it->second.lock();
+            if (entry.get() == nullptr)
+            {
+                entry = std::make_shared<Entry>(conn);
+                _entries[conn.get()] = entry;
+            }
+            _buckets[_cur].insert(entry);
+        }
+        // 连接关闭时调用
+        void remove(const muduo::net::TcpConnectionPtr &conn)
+        {
+            _entries.erase(conn.get());
+        }
+        // 不再检测任何连接(时间轮被替换时): 条目释放时不关闭连接
+        void release()
+        {
+            for (auto &it : _entries)
+            {
+                auto entry = it.second.lock();
+                if (entry)
+                    entry->conn.reset();
+            }
+            _entries.clear();
+        }
+        // 每秒调用一次: 转动一格，清空最老的桶
+        void tick()
+        {
+            _cur = (_cur + 1) % _buckets.size();
+            _buckets[_cur].clear();
+        }
+
+    private:
+        struct Entry
+        {
+            using ptr = std::shared_ptr<Entry>;
+            Entry(const muduo::net::TcpConnectionPtr &c) : conn(c) {}
+            ~Entry()
+            {
+                muduo::net::TcpConnectionPtr c = conn.lock();
+                if (c && c->connected())
+                {
+                    INF_LOG("连接空闲超时, 主动关闭: %s", c->peerAddress().toIpPort().c_str());
+                    c->forceClose(); // 走正常的连接关闭流程，上层的关闭回调会被调用
+                }
+            }
+            std::weak_ptr<muduo::net::TcpConnection> conn;
+        };
+        std::vector<std::unordered_set<Entry::ptr>> _buckets;
+        size_t _cur;
+        std::unordered_map<muduo::net::TcpConnection *, std::weak_ptr<Entry>> _entries;
+    };
+
     class MuduoServer : public BaseServer
     {
     public:
         using ptr = std::shared_ptr<MuduoServer>;
         MuduoServer(int port)
             : _protocol(LVProtocolFactory::create()), _server(&_baseloop, muduo::net::InetAddress("0.0.0.0", port),
-                                                              "MuduoServer", muduo::net::TcpServer::kNoReusePort) {}
+                                                              "MuduoServer", muduo::net::TcpServer::kNoReusePort)
+        {
+            auto pong = MessageFactory::create<HeartbeatMessage>();
+            pong->setMtype(MType::RSP_HEARTBEAT);
+            _pong_frame = _protocol->serialize(pong);
+        }
 
         // 设置回调的接口继承了父类，是有的
         virtual void start()
         {
             _server.setConnectionCallback(std::bind(&MuduoServer::OnConnection, this, std::placeholders::_1));
             _server.setMessageCallback(std::bind(&MuduoServer::OnMessage, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+            if (_idle_timeout > 0) // 每个 I/O loop 启动时给它配一个时间轮
+                _server.setThreadInitCallback(std::bind(&MuduoServer::OnThreadInit, this, std::placeholders::_1));
+            _server.setThreadNum(_thread_num);
             _server.start();
             _baseloop.loop();
         }
+        virtual void runEvery(double interval, const std::function<void()> &task) override
+        {
+            _baseloop.runEvery(interval, task);
+        }
 
     private:
+        void OnThreadInit(muduo::net::EventLoop *loop)
+        {
+            auto wheel = std::make_shared<TimingWheel>(_idle_timeout);
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wheels[loop] = wheel;
+            }
+            loop->runEvery(1.0, std::bind(&TimingWheel::tick, wheel));
+        }
+        // 连接所属 loop 的时间轮(建立连接时放在连接的 context 里, 之后无需查表)
+        TimingWheel::ptr getWheel(const muduo::net::TcpConnectionPtr &conn)
+        {
+            const boost::any &ctx = conn->getContext();
+            if (ctx.empty())
+                return TimingWheel::ptr();
+            return boost::any_cast<TimingWheel::ptr>(ctx);
+        }
         // 连接建立/关闭的回调函数，内部自行判断是关闭了还是销毁了
         // 我们在这里相当于对回调函数进行了进一步封装，统一基础行为
         // 从而又保留设置回调的入口，用户可以自行再扩展
@@ -211,6 +391,12 @@ namespace TrRpc
                 {
                     std::unique_lock<std::mutex> lock(_mutex);
                     _conns.insert(std::make_pair(conn, base_conn));
+                    auto it = _wheels.find(conn->getLoop());
+                    if (it != _wheels.end())
+                    {
+                        conn->setContext(it->second);
+                        it->second->touch(conn);
+                    }
                 }
                 // 连接建立成功时的回调函数，如果有就调用
                 if (_cb_connection)
@@ -220,6 +406,9 @@ namespace TrRpc
             {
                 auto base_conn = ConnectionFactory::create(conn, _protocol);
                 std::cout << "连接关闭" << std::endl;
+                auto wheel = getWheel(conn);
+                if (wheel)
+                    wheel->remove(conn);
                 {
                     std::unique_lock<std::mutex> lock(_mutex);
                     auto it = _conns.find(conn);
@@ -236,6 +425,9 @@ namespace TrRpc
         void OnMessage(const muduo::net::TcpConnectionPtr &conn, muduo::net::Buffer *buf, muduo::Timestamp)
         {
             DBG_LOG("连接有数据到来, 立即处理");
+            auto wheel = getWheel(conn);
+            if (wheel) // 有数据往来，连接是活跃的
+                wheel->touch(conn);
             auto base_buf = BufferFactory::create(buf);
             while (1) // 有可能一次有多条完整的请求数据
             {
@@ -260,6 +452,12 @@ namespace TrRpc
                     conn->shutdown();
                     return;
                 }
+                // 心跳探测只用来保活，直接回复，不交给上层
+                if (base_msg->mtype() == MType::REQ_HEARTBEAT)
+                {
+                    conn->send(_pong_frame);
+                    continue;
+                }
                 // 代表反序列化成功, 核心业务数据已经在 base_msg里了
                 BaseConnection::ptr base_conn;
                 {
@@ -286,9 +484,50 @@ namespace TrRpc
         // 避免回调函数和 muduo 库的强绑定
         // 这个是个临界资源，操作的时候注意加锁
         std::unordered_map<muduo::net::TcpConnectionPtr, BaseConnection::ptr> _conns;
+        std::unordered_map<muduo::net::EventLoop *, TimingWheel::ptr> _wheels; // 每个 I/O loop 的时间轮
+        std::string _pong_frame;                                                // 预先序列化好的心跳应答
         std::mutex _mutex;
     };
 
+    // 广播: 把同一条消息发给一批连接，消息只序列化一次
+    // 连接按所属的 I/O loop 分组，每个 loop 只投递一个发送任务，由各个 loop 线程并行地写到自己的连接上
+    // 总是排队(queueInLoop)而不是在当前 loop 中直接发送: 调用者自己就在某个 I/O loop 中时, 这个 loop 的连接也和其它 loop 一样
+    // 按投递的顺序发送, 先后两次广播的消息在每个连接上都不会乱序
+    class Broadcaster
+    {
+    public:
+        static void send(const std::vector<BaseConnection::ptr> &conns, const BaseMessage::ptr &msg)
+        {
+            if (conns.empty())
+                return;
+            auto frame = std::make_shared<std::string>(LVProtocolFactory::create()->serialize(msg));
+            std::unordered_map<muduo::net::EventLoop *, std::vector<muduo::net::TcpConnectionPtr>> groups;
+            for (auto &conn : conns)
+            {
+                auto muduo_conn = std::dynamic_pointer_cast<MuduoConnection>(conn);
+                if (muduo_conn.get() == nullptr) // 不是服务端的连接，逐个发送
+                {
+                    conn->send(msg);
+                    continue;
+                }
+                auto &tcp_conn = muduo_conn->tcpConnection();
+                groups[tcp_conn->getLoop()].push_back(tcp_conn);
+            }
+            for (auto &group : groups)
+            {
+                auto tcp_conns = std::make_shared<std::vector<muduo::net::TcpConnectionPtr>>();
+                tcp_conns->swap(group.second);
+                group.first->queueInLoop([frame, tcp_conns]()
+                                         {
+                                             for (auto &tcp_conn : *tcp_conns)
+                                             {
+                                                 if (tcp_conn->connected())
+                                                     tcp_conn->send(frame->data(), frame->size());
+                                             } });
+            }
+        }
+    };
+
     class ServerFactory
     {
     public:
@@ -303,32 +542,36 @@ namespace TrRpc
     {
     public:
         using ptr = std::shared_ptr<MuduoClient>;
-        MuduoClient(std::string sip, int sport)
+        // max_pending: 连接建立之前最多缓存多少字节的待发送数据
+        MuduoClient(std::string sip, int sport, size_t max_pending = defaultMaxPending)
             : _protocol(LVProtocolFactory::create()), _baseloop(_loopthread.startLoop()),
-              _downlatch(1), _client(_baseloop, muduo::net::InetAddress(sip, sport), "MuduoClient")
+              _downlatch(1), _client(_baseloop, muduo::net::InetAddress(sip, sport), "MuduoClient"),
+              _conn(std::make_shared<MuduoClientConnection>(_protocol, max_pending)), _established(false)
         {
         }
         void connect()
+        {
+            asyncConnect();
+            _downlatch.wait();
+            DBG_LOG("连接服务器成功");
+        }
+        // 只发起连接，不等待: 连接建立前 send 的数据会被缓存，连接建立后在 loop 线程中发出并调用 _cb_connection
+        virtual void asyncConnect() override
         {
             _client.setConnectionCallback(std::bind(&MuduoClient::OnConnection, this, std::placeholders::_1));
             _client.setMessageCallback(std::bind(&MuduoClient::OnMessage, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+            _baseloop->runInLoop(std::bind(&MuduoClient::startTimers, this));
             _client.connect();
-            _downlatch.wait();
-            DBG_LOG("连接服务器成功");
         }
         virtual bool send(const BaseMessage::ptr &msg) override
         {
-            if (_conn->connected() == false)
-            {
-                std::cout << "连接已经断开，发送数据失败！\n";
-                return false;
-            }
-            _conn->send(msg); // 发数据给服务器
-            return true;
+            return _conn->trySend(msg); // 发数据给服务器(连接尚未建立时先缓存)
         }
+        // 断开连接; 连接还没有建立时停止连接(muduo 会一直重试连接)
         virtual void shutdown() override
         {
             _client.disconnect();
+            _client.stop();
         }
         virtual BaseConnection::ptr connection() override
         {
@@ -336,34 +579,102 @@ namespace TrRpc
         }
         virtual bool connected()
         {
-            return (_conn && _conn->connected());
+            return _conn->connected();
+        }
+        virtual void runEvery(double interval, const std::function<void()> &task) override
+        {
+            _baseloop->runEvery(interval, task);
+        }
+        virtual void runAfter(double delay, const std::function<void()> &task) override
+        {
+            _baseloop->runAfter(delay, task);
+        }
+        virtual bool inLoopThread() override
+        {
+            return _baseloop->isInLoopThread();
+        }
+        // 定时器只在 loop 线程中访问: 修改也交给 loop 线程, 已经启动的定时器按新的设置重新启动
+        virtual void setHeartbeat(int interval, int idle_timeout) override
+        {
+            _baseloop->runInLoop([this, interval, idle_timeout]()
+                                 {
+                                     _heartbeat_interval = interval;
+                                     _idle_timeout = idle_timeout;
+                                     if (_timers_started)
+                                         restartTimers(); });
         }
 
     private:
+        // 启动心跳定时器 和 空闲检测的时间轮(都在客户端自己的 loop 中运行)
+        // 定时任务只持有连接的弱引用 / 时间轮的强引用，不依赖 MuduoClient 对象本身的生命周期
+        void startTimers()
+        {
+            if (_timers_started)
+                return;
+            _timers_started = true;
+            if (_heartbeat_interval > 0)
+            {
+                auto ping = MessageFactory::create<HeartbeatMessage>();
+                ping->setMtype(MType::REQ_HEARTBEAT);
+                std::weak_ptr<MuduoClientConnection> weak_conn = _conn;
+                _heartbeat_timer = _baseloop->runEvery(_heartbeat_interval, [weak_conn, ping]()
+                                                       {
+                                                           auto conn = weak_conn.lock();
+                                                           if (conn && conn->connected())
+                                                               conn->send(ping); });
+            }
+            if (_idle_timeout > 0)
+            {
+                _wheel = std::make_shared<TimingWheel>(_idle_timeout);
+                _wheel_timer = _baseloop->runEvery(1.0, std::bind(&TimingWheel::tick, _wheel));
+                auto conn = _client.connection();
+                if (conn && conn->connected()) // 连接之后才修改设置: 当前连接从现在开始计时
+                    _wheel->touch(conn);
+            }
+        }
+        void restartTimers()
+        {
+            _baseloop->cancel(_heartbeat_timer);
+            _baseloop->cancel(_wheel_timer);
+            if (_wheel)
+                _wheel->release();
+            _wheel.reset();
+            _timers_started = false;
+            startTimers();
+        }
         // 连接建立/关闭的回调函数，内部自行判断是关闭了还是销毁了
         void OnConnection(const muduo::net::TcpConnectionPtr &conn) // muudo的可调用对象要求传递这个参数
         {
             // connected 返回连接状态
+            BaseConnection::ptr base_conn = _conn;
             if (conn->connected())
             {
                 std::cout << "连接建立" << std::endl;
-                _conn = ConnectionFactory::create(conn, _protocol);
+                if (_wheel)
+                    _wheel->touch(conn);
+                _conn->attach(conn);
+                _established = true;
                 if (_cb_connection)
-                    _cb_connection(_conn);
+                    _cb_connection(base_conn);
                 _downlatch.countDown(); // 计数--，为0时唤醒阻塞
             }
             else
             {
                 std::cout << "连接关闭" << std::endl;
-                if (_cb_close && _conn)
-                    _cb_close(_conn);
-                _conn.reset(); // 清空
+                if (_wheel)
+                    _wheel->remove(conn);
+                _conn->detach();
+                if (_cb_close && _established)
+                    _cb_close(base_conn);
+                _established = false;
             }
         }
         // 收到数据以后的业务处理回调函数(其实和服务端一样，收到的都是网络字节序，在 buf 里)
         void OnMessage(const muduo::net::TcpConnectionPtr &conn, muduo::net::Buffer *buf, muduo::Timestamp)
         {
             DBG_LOG("连接有数据到来, 客户端立即处理");
+            if (_wheel) // 有数据往来(包括心跳应答)，连接是活跃的
+                _wheel->touch(conn);
             auto base_buf = BufferFactory::create(buf);
             while (1) // 有可能一次有多条完整的请求数据
             {
@@ -388,19 +699,30 @@ namespace TrRpc
                     conn->shutdown();
                     return;
                 }
+                if (base_msg->mtype() == MType::RSP_HEARTBEAT) // 心跳应答只用来保活
+                    continue;
                 if (_cb_message) // 调用业务处理回调函数
-                    _cb_message(_conn, base_msg);
+                {
+                    BaseConnection::ptr base_conn = _conn;
+                    _cb_message(base_conn, base_msg);
+                }
             }
         }
 
     private:
+        static const size_t defaultMaxPending = (1 << 22); // 连接建立前默认最多缓存 4MB
         const size_t maxDataSize = (1 << 16); // 用于判断请求数据是太长而错误
         BaseProtocol::ptr _protocol;
         muduo::net::EventLoopThread _loopthread;
         muduo::net::EventLoop *_baseloop;
         muduo::CountDownLatch _downlatch;
         muduo::net::TcpClient _client;
-        BaseConnection::ptr _conn; // 保存与服务端的连接
+        MuduoClientConnection::ptr _conn; // 保存与服务端的连接(构造时就存在, 连接建立后才真正可用)
+        bool _established;                // 只在 loop 线程中访问
+        bool _timers_started = false;     // 只在 loop 线程中访问
+        muduo::net::TimerId _heartbeat_timer;
+        muduo::net::TimerId _wheel_timer;
+        TimingWheel::ptr _wheel;          // 空闲检测(只在 loop 线程中使用)
     };
     class ClientFactory
     {
@@ -0,0 +1,88 @@
+#pragma once
+#include "../common/net.hpp"
+#include <mutex>
+#include <vector>
+
+namespace TrRpc
+{
+    namespace server
+    {
+        // 注册中心集群: 每个节点都主动连接其它所有节点(全连接), 把直接连在本节点上的服务提供者的变化同步过去
+        // 只同步本节点自己的提供者，收到的同步消息不会再转发, 所以不会形成环路
+        class RegistryPeers
+        {
+        public:
+            using ptr = std::shared_ptr<RegistryPeers>;
+            using SyncCallback = std::function<void(const BaseConnection::ptr &)>; // 连上某个节点后，把全量数据发过去
+            RegistryPeers(const std::vector<Address> &peers, const SyncCallback &cb)
+                : _sync_callback(cb)
+            {
+                for (auto &peer : peers)
+                {
+                    auto link = std::make_shared<Link>();
+                    link->addr = peer;
+                    _links.push_back(link);
+                }
+            }
+            void start()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                for (auto &link : _links)
+                    connect(link);
+            }
+            // 把一条同步消息发给所有节点(连接还没建立时先缓存在客户端中)
+            void broadcast(const BaseMessage::ptr &msg)
+            {
+                std::vector<BaseClient::ptr> clients;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    for (auto &link : _links)
+                        clients.push_back(link->client);
+                }
+                for (auto &client : clients)
+                    client->send(msg);
+            }
+            // 定期检查，连接断开了的节点重新连接
+            // 在注册中心的主 loop 中调用，不在这些客户端自己的 loop 线程中，可以安全地释放断开的客户端
+            void check()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                for (auto &link : _links)
+                {
+                    if (link->down)
+                        connect(link);
+                }
+            }
+
+        private:
+            struct Link
+            {
+                Address addr;
+                BaseClient::ptr client;
+                bool down = false; // 连接建立后又断开了，等待 check 重连
+            };
+            // 调用者已加锁
+            void connect(const std::shared_ptr<Link> &link)
+            {
+                auto client = ClientFactory::create(link->addr.first, link->addr.second);
+                BaseClient *raw = client.get();
+                SyncCallback sync = _sync_callback;
+                client->SetConnectionCallback([sync](BaseConnection::ptr &conn)
+                                              { sync(conn); });
+                client->SetCloseCallback([this, link, raw](BaseConnection::ptr &)
+                                         {
+                                             std::unique_lock<std::mutex> lock(_mutex);
+                                             if (link->client.get() == raw)
+                                                 link->down = true; });
+                link->client = client;
+                link->down = false;
+                client->asyncConnect(); // 对端节点还没启动时，底层会一直重试连接
+            }
+
+        private:
+            std::mutex _mutex;
+            SyncCallback _sync_callback;
+            std::vector<std::shared_ptr<Link>> _links;
+        };
+    }
+}
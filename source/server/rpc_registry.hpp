@@ -1,7 +1,11 @@
 #pragma once
 #include "../common/net.hpp"
+#include "rpc_snapshot.hpp"
 #include <set>
+#include <map>
 #include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
 
 namespace TrRpc
 {
@@ -11,95 +15,348 @@ namespace TrRpc
         {
         public:
             using ptr = std::shared_ptr<ProviderManager>;
+            struct MethodEntry;
             struct Provider
             {
                 using ptr = std::shared_ptr<Provider>;
                 Provider(const BaseConnection::ptr &c, const Address &h)
                     : conn(c), host(h) {}
-                BaseConnection::ptr conn;
+                BaseConnection::ptr conn; // 从快照恢复、还没重新注册的提供者(租约)没有连接
 
-                Address host;                     // 主机
-                std::vector<std::string> methods; // 提供的方法
-                std::mutex _mutex;                // 对 methods 操作的时候有线程安全问题
-                void addmethod(std::string method)
-                {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    methods.emplace_back(method);
-                }
+                Address host;                // 主机
+                LoadInfo load;               // 最近一次上报的负载
+                int weight = DEFAULT_WEIGHT; // 由负载算出来的权重
+                // 提供的方法 -> 自己在该方法提供者列表中的下标, 删除时直接定位, 不需要查找
+                // (以上成员都由 ProviderManager 的锁保护)
+                std::unordered_map<MethodEntry *, size_t> slots;
+                std::chrono::steady_clock::time_point lease_expire; // 租约到期时间(只对从快照恢复的提供者有效)
             };
+            // 一个方法的所有提供者
+            // 方法名只在 _methods 的 key 中存一份, 提供者通过 MethodEntry 指针引用它(unordered_map 的节点地址不会变)
+            // 列表中存裸指针: 提供者由 _conns / _leases / _replicas 持有, 从这些表中删除之前一定先从列表中摘掉
+            struct MethodEntry
+            {
+                const std::string *name = nullptr;
+                std::vector<Provider *> providers;
+            };
+            // 根据负载计算权重(1 ~ 100): cpu 越忙、积压的请求越多，权重越低
+            // qps 只反映吞吐，不代表主机忙不忙，所以不参与计算
+            static int calcWeight(const LoadInfo &load)
+            {
+                double idle = 1.0 - std::min(std::max(load.cpu, 0.0), 95.0) / 100.0;
+                double weight = DEFAULT_WEIGHT * idle / (1.0 + load.inflight / 8.0);
+                return std::max(1, (int)weight);
+            }
             // 有新的服务注册: 1. 这个 conn 不存在;   2. conn存在 --> 这个主机提供的服务增多了
-            void addProvider(const BaseConnection::ptr &conn, const Address &host, const std::string &method)
+            Provider::ptr addProvider(const BaseConnection::ptr &conn, const Address &host, const std::string &method)
+            {
+                return addProvider(conn, host, std::vector<std::string>{method});
+            }
+            // 批量注册: 一个主机的多个方法在一次加锁内全部加入，发现者不会看到只注册了一部分的中间状态
+            Provider::ptr addProvider(const BaseConnection::ptr &conn, const Address &host, const std::vector<std::string> &methods)
             {
+                std::unique_lock<std::mutex> lock(_mutex);
                 Provider::ptr provider;
+                auto it = _conns.find(conn);
+                if (it == _conns.end())
                 {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    auto it = _conns.find(conn);
-                    if (it == _conns.end())
-                    {
-                        // 如果是新的: 构建 provider 对象, 添加到 _conns中
-                        provider = std::make_shared<Provider>(conn, host);
-                        _conns.insert(std::make_pair(conn, provider));
-                    }
-                    else // 旧的直接获取
-                        provider = it->second;
-                    // 对应方法多一个能提供的 主机(provider)
-                    _providers[method].insert(provider);
+                    // 如果是新的: 构建 provider 对象, 添加到 _conns中
+                    provider = std::make_shared<Provider>(conn, host);
+                    _conns.insert(std::make_pair(conn, provider));
                 }
-                // 对应的主机(provider)中添加它能提供的新方法
-                provider->addmethod(method);
+                else // 旧的直接获取
+                    provider = it->second;
+                for (auto &method : methods)
+                {
+                    // 对应方法多一个能提供的 主机(provider), 重复注册同一个方法时什么都不做
+                    MethodEntry *entry = intern(method);
+                    link(provider.get(), entry);
+                    // 该主机在快照中有这个方法的租约: 真正的提供者重新注册了，由它接替租约
+                    // (先加入再撤销租约, 撤销时这个方法的列表不会变空被回收)
+                    confirmLease(provider.get(), entry);
+                }
+                _version++;
+                return provider;
             }
-            // 当一个服务提供者断开连接的时候，获取他的信息--用于进行服务下线通知
-            Provider::ptr getProvider(const BaseConnection::ptr &conn)
+            // 服务提供者上报负载: 更新权重，返回该提供者(没有注册过服务时返回空)
+            // old_weight / new_weight 是输出型参数，用于判断是否需要通知发现者
+            Provider::ptr updateLoad(const BaseConnection::ptr &conn, const LoadInfo &load, int &old_weight, int &new_weight)
             {
-                {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    auto it = _conns.find(conn);
-                    if (it != _conns.end())
-                        return it->second;
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto it = _conns.find(conn);
+                if (it == _conns.end())
                     return Provider::ptr();
-                }
+                Provider::ptr provider = it->second;
+                old_weight = provider->weight;
+                provider->load = load;
+                provider->weight = calcWeight(load);
+                new_weight = provider->weight;
+                if (new_weight != old_weight)
+                    _version++;
+                return provider;
+            }
+            int weight(const Provider::ptr &provider)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                return provider->weight;
+            }
+            // 提供者当前提供的所有方法
+            std::vector<std::string> methods(const Provider::ptr &provider)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                return methodList(provider.get());
             }
             // 当一个服务提供者断开连接的时候，删除它的关联信息
-            void delProvider(const BaseConnection::ptr &conn)
+            // 返回是否真的删除了, removed 中带出它的主机和方法 -- 用于进行服务下线通知
+            bool delProvider(const BaseConnection::ptr &conn, ProviderRecord &removed)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto it = _conns.find(conn);
+                if (it == _conns.end())
+                    return false;
+                removed = unlinkAll(it->second.get());
+                _conns.erase(it);
+                _version++;
+                return true;
+            }
+            // 从快照恢复服务提供者: 它们没有连接，在 lease 时间内可以被发现，
+            // 期间重新注册的方法由真正的提供者接替，到期仍未重新注册的会被 expireLeases 清理
+            void restore(const std::vector<ProviderRecord> &records, std::chrono::milliseconds lease)
             {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto expire = std::chrono::steady_clock::now() + lease;
+                for (auto &record : records)
+                {
+                    if (record.methods.empty() || _leases.count(record.host))
+                        continue;
+                    auto provider = std::make_shared<Provider>(BaseConnection::ptr(), record.host);
+                    provider->weight = std::max(1, std::min(record.weight, DEFAULT_WEIGHT));
+                    provider->lease_expire = expire;
+                    for (auto &method : record.methods)
+                        link(provider.get(), intern(method));
+                    _leases[record.host] = provider;
+                }
+            }
+            // 清理到期的租约，返回被清理的提供者(用于下线通知)
+            std::vector<ProviderRecord> expireLeases()
+            {
+                std::vector<ProviderRecord> expired;
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto now = std::chrono::steady_clock::now();
+                for (auto it = _leases.begin(); it != _leases.end();)
+                {
+                    if (it->second->lease_expire > now)
+                    {
+                        ++it;
+                        continue;
+                    }
+                    expired.push_back(unlinkAll(it->second.get()));
+                    it = _leases.erase(it);
+                    _version++;
+                }
+                return expired;
+            }
+            // 其它注册中心节点同步过来的提供者上线，已经存在时更新权重
+            // 同一个对端节点同步过来的提供者可能有很多个，所以不放在 _conns 中，按 (对端连接, 主机) 管理
+            void addReplica(const BaseConnection::ptr &peer, const Address &host, const std::string &method, int weight)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto &hosts = _replicas[peer];
                 Provider::ptr provider;
+                auto it = hosts.find(host);
+                if (it == hosts.end())
                 {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    auto it = _conns.find(conn);
-                    if (it == _conns.end())
-                        return;
+                    provider = std::make_shared<Provider>(peer, host);
+                    hosts[host] = provider;
+                }
+                else
                     provider = it->second;
-                    for (auto &method : provider->methods)
+                provider->weight = std::max(1, std::min(weight, DEFAULT_WEIGHT));
+                link(provider.get(), intern(method));
+            }
+            // 其它注册中心节点同步过来的提供者下线，返回是否真的删除了
+            bool delReplica(const BaseConnection::ptr &peer, const Address &host, const std::string &method)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto peer_it = _replicas.find(peer);
+                if (peer_it == _replicas.end())
+                    return false;
+                auto it = peer_it->second.find(host);
+                auto entry_it = _methods.find(method);
+                if (it == peer_it->second.end() || entry_it == _methods.end())
+                    return false;
+                Provider *provider = it->second.get();
+                if (unlink(provider, &entry_it->second) == false)
+                    return false;
+                if (provider->slots.empty())
+                    peer_it->second.erase(it);
+                if (peer_it->second.empty())
+                    _replicas.erase(peer_it);
+                return true;
+            }
+            // 与对端节点的连接断开: 删除它同步过来的所有提供者，返回被删除的提供者(用于下线通知)
+            std::vector<ProviderRecord> delReplicas(const BaseConnection::ptr &peer)
+            {
+                std::vector<ProviderRecord> result;
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto peer_it = _replicas.find(peer);
+                if (peer_it == _replicas.end())
+                    return result;
+                for (auto &it : peer_it->second)
+                    result.push_back(unlinkAll(it.second.get()));
+                _replicas.erase(peer_it);
+                return result;
+            }
+            // 本节点的服务提供者(include_leases 为 true 时包括还没到期的租约)，用于写快照 和 同步给其它节点
+            // 其它节点同步过来的提供者不包括在内: 它们由各自的节点负责
+            std::vector<ProviderRecord> records(bool include_leases = true)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                std::vector<ProviderRecord> result;
+                // 同一主机可能同时有租约和重新注册的部分方法，合并成一条
+                std::map<Address, size_t> index;
+                auto add = [&](const Provider::ptr &provider)
+                {
+                    auto it = index.find(provider->host);
+                    if (it == index.end())
                     {
-                        _providers[method].erase(provider);
+                        index[provider->host] = result.size();
+                        ProviderRecord record;
+                        record.host = provider->host;
+                        record.weight = provider->weight;
+                        result.push_back(record);
+                        it = index.find(provider->host);
                     }
-                    _conns.erase(it);
+                    auto methods = methodList(provider.get());
+                    auto &record = result[it->second];
+                    record.methods.insert(record.methods.end(), methods.begin(), methods.end());
+                };
+                for (auto &it : _conns)
+                    add(it.second);
+                if (include_leases)
+                {
+                    for (auto &it : _leases)
+                        add(it.second);
                 }
+                return result;
+            }
+            // 提供者表的版本号: 每次变化都会增加，用于判断是否需要重新写快照
+            uint64_t version()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                return _version;
             }
-            // 提供给客户端，用来返回方法的所有提供者的主机
-            std::vector<Address> methodHosts(const std::string &method)
+            // 提供给客户端，用来返回方法的所有提供者的主机, weights 不为空时同时返回各主机的权重
+            std::vector<Address> methodHosts(const std::string &method, std::vector<int> *weights = nullptr)
             {
                 std::unique_lock<std::mutex> lock(_mutex);
-                auto it = _providers.find(method);
-                if (it == _providers.end())
+                auto it = _methods.find(method);
+                if (it == _methods.end())
                 {
                     return std::vector<Address>();
                 }
+                auto &providers = it->second.providers;
                 std::vector<Address> result;
-                for (auto &provider : it->second)
+                result.reserve(providers.size());
+                if (weights)
+                    weights->reserve(providers.size());
+                for (auto provider : providers)
                 {
                     result.push_back(provider->host);
+                    if (weights)
+                        weights->push_back(provider->weight);
                 }
                 return result;
             }
 
+        private:
+            // 以下都由调用者加锁
+            // 取得方法对应的表项, 第一次出现的方法名在这里存下来
+            MethodEntry *intern(const std::string &method)
+            {
+                auto it = _methods.find(method);
+                if (it == _methods.end())
+                {
+                    it = _methods.insert(std::make_pair(method, MethodEntry())).first;
+                    it->second.name = &it->first;
+                }
+                return &it->second;
+            }
+            // 把提供者加到方法的列表末尾，已经在列表中时返回 false
+            bool link(Provider *provider, MethodEntry *entry)
+            {
+                if (provider->slots.insert(std::make_pair(entry, entry->providers.size())).second == false)
+                    return false;
+                entry->providers.push_back(provider);
+                return true;
+            }
+            // 把提供者从方法的列表中摘掉: 用列表最后一个元素填补空位(O(1)), 不在列表中时返回 false
+            // 方法没有提供者之后回收它的表项(entry 随之失效)
+            bool unlink(Provider *provider, MethodEntry *entry)
+            {
+                auto slot = provider->slots.find(entry);
+                if (slot == provider->slots.end())
+                    return false;
+                size_t index = slot->second;
+                provider->slots.erase(slot);
+                Provider *last = entry->providers.back();
+                entry->providers[index] = last;
+                entry->providers.pop_back();
+                if (last != provider)
+                    last->slots[entry] = index;
+                if (entry->providers.empty())
+                    _methods.erase(_methods.find(*entry->name));
+                return true;
+            }
+            // 把提供者从它所有方法的列表中摘掉, 返回它原来的信息
+            ProviderRecord unlinkAll(Provider *provider)
+            {
+                ProviderRecord record;
+                record.host = provider->host;
+                record.weight = provider->weight;
+                record.methods = methodList(provider);
+                std::vector<MethodEntry *> entries;
+                entries.reserve(provider->slots.size());
+                for (auto &slot : provider->slots)
+                    entries.push_back(slot.first);
+                for (auto entry : entries)
+                    unlink(provider, entry);
+                return record;
+            }
+            std::vector<std::string> methodList(Provider *provider)
+            {
+                std::vector<std::string> result;
+                result.reserve(provider->slots.size());
+                for (auto &slot : provider->slots)
+                    result.push_back(*slot.first->name);
+                return result;
+            }
+            // 真正的提供者注册了 entry 对应的方法, 撤销同一主机在这个方法上的租约
+            void confirmLease(Provider *provider, MethodEntry *entry)
+            {
+                auto it = _leases.find(provider->host);
+                if (it == _leases.end())
+                    return;
+                Provider *lease = it->second.get();
+                unlink(lease, entry);
+                if (provider->weight == DEFAULT_WEIGHT) // 还没收到负载上报之前沿用快照中的权重
+                    provider->weight = lease->weight;
+                if (lease->slots.empty())
+                    _leases.erase(it);
+            }
+
         private:
             std::mutex _mutex;
-            // 用 set 是因为 set 支持快速查询, 比vector快
-            // 对于一个方法，有哪些服务提供者能提供
-            std::unordered_map<std::string, std::set<Provider::ptr>> _providers;
+            // 方法名 -> 能提供这个方法的服务提供者
+            // 增删提供者都是 O(1): 提供者自己记录着在每个方法列表中的位置，服务发现时直接顺序拷贝列表
+            std::unordered_map<std::string, MethodEntry> _methods;
             // 一个连接对应的服务提供者是谁
             std::unordered_map<BaseConnection::ptr, Provider::ptr> _conns;
+            // 从快照恢复的、等待重新注册确认的提供者(主机 -> 提供者)
+            std::map<Address, Provider::ptr> _leases;
+            // 其它注册中心节点同步过来的提供者(对端节点的连接 -> (主机 -> 提供者))
+            std::unordered_map<BaseConnection::ptr, std::map<Address, Provider::ptr>> _replicas;
+            uint64_t _version = 0;
         };
         class DiscovererManager
         {
@@ -112,6 +369,8 @@ namespace TrRpc
                     : conn(c) {}
                 BaseConnection::ptr conn;
                 std::vector<std::string> methods; // 发现过的服务
+                std::vector<ServiceChange> pending; // 还没发出去的变化(由 DiscovererManager 的锁保护)
+                uint64_t last_version = 0;          // 上一条发给它的增量通知的版本号
                 std::mutex _mutex;
                 void addmethod(std::string method)
                 {
@@ -152,58 +411,183 @@ namespace TrRpc
                     {
                         _discoverers[method].erase(discover);
                     }
+                    _dirty.erase(discover);
                     _conns.erase(it);
                 }
             }
+            // 通知合并窗口(ms): 窗口内的变化合并成每个发现者一条增量通知，由定时器调用 flush 发出
+            // 为 0 时每个变化立即发出(仍然是增量通知的格式)
+            void setWindow(int ms)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _window = ms;
+            }
+            // 当前版本号: 服务发现响应中携带，需要在读取提供者列表之前获取
+            uint64_t version()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                return _version;
+            }
+            // 把积攒的变化发出去: 每个有变化的发现者一条增量通知
+            // 在锁内只把待发送的变化取出来，发送在锁外进行，不阻塞同时到来的注册 / 发现请求
+            // 收到同样变化的发现者(关心同样的方法)共用一条消息，只序列化一次，再按 I/O loop 分组并行发送
+            void flush()
+            {
+                // 保证多次 flush 的发送顺序与版本号顺序一致
+                std::unique_lock<std::mutex> flush_lock(_flush_mutex);
+                std::vector<std::pair<ServiceRequest::ptr, std::vector<BaseConnection::ptr>>> batches;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if (_dirty.empty())
+                        return;
+                    // 分组依据: 上一条通知的版本号 + 这次的变化序列(变化的版本号唯一标识一个变化)
+                    std::unordered_map<std::string, size_t> groups;
+                    for (auto &discover : _dirty)
+                    {
+                        std::string key = std::to_string(discover->last_version);
+                        for (auto &change : discover->pending)
+                            key += "," + std::to_string(change.version);
+                        auto it = groups.find(key);
+                        if (it == groups.end())
+                        {
+                            auto msg_req = MessageFactory::create<ServiceRequest>();
+                            msg_req->setId(UUid::uuid());
+                            msg_req->setMtype(MType::REQ_SERVICE);
+                            msg_req->setOptype(ServiceOptype::SERVICE_DELTA);
+                            msg_req->setPrevVersion(discover->last_version);
+                            msg_req->setVersion(_version);
+                            msg_req->setChanges(discover->pending);
+                            it = groups.insert(std::make_pair(key, batches.size())).first;
+                            batches.push_back(std::make_pair(msg_req, std::vector<BaseConnection::ptr>()));
+                        }
+                        batches[it->second].second.push_back(discover->conn);
+                        discover->pending.clear();
+                        discover->last_version = _version;
+                    }
+                    _dirty.clear();
+                }
+                for (auto &batch : batches)
+                    Broadcaster::send(batch.second, batch.first);
+            }
             // 新服务上线时，进行上线通知(通知的是发现者，所以在这个模块里面)
-            void onlineNotify(const std::string &method, const Address &host)
+            // 已上线主机的权重变化时也发上线通知，发现者收到后更新该主机的权重
+            void onlineNotify(const std::string &method, const Address &host, int weight = DEFAULT_WEIGHT)
+            {
+                return notify(std::vector<std::string>{method}, host, ServiceOptype::SERVICE_ONLINE, weight);
+            }
+            // 一个主机的多个方法同时上线(批量注册 / 权重变化): 即使不开合并窗口，每个发现者也只收到一条通知
+            void onlineNotify(const std::vector<std::string> &methods, const Address &host, int weight = DEFAULT_WEIGHT)
             {
-                return notify(method, host, ServiceOptype::SERVICE_ONLINE);
+                return notify(methods, host, ServiceOptype::SERVICE_ONLINE, weight);
             }
             // 服务下线通知
             void offlineNotify(const std::string &method, const Address &host)
             {
-                return notify(method, host, ServiceOptype::SERVICE_OFFLINE);
+                return notify(std::vector<std::string>{method}, host, ServiceOptype::SERVICE_OFFLINE);
+            }
+            void offlineNotify(const std::vector<std::string> &methods, const Address &host)
+            {
+                return notify(methods, host, ServiceOptype::SERVICE_OFFLINE);
             }
 
         private:
-            void notify(const std::string &method, const Address &host, ServiceOptype optype)
+            // 每个变化都让版本号加 1，变化先挂到关心这个方法的发现者身上，等 flush 时合并发出
+            // prev_version 是上一条发给该发现者的增量通知的版本号，发现者据此判断中间有没有漏掉通知
+            void notify(const std::vector<std::string> &methods, const Address &host, ServiceOptype optype, int weight = DEFAULT_WEIGHT)
             {
                 {
                     std::unique_lock<std::mutex> lock(_mutex);
-                    auto it = _discoverers.find(method);
-                    if (it == _discoverers.end())
-                        return;
-                    auto discovers = it->second; // 该方法对应的发现者们
-                    auto msg_req = MessageFactory::create<ServiceRequest>();
-                    msg_req->setId(UUid::uuid());
-                    msg_req->setMtype(MType::REQ_SERVICE);
-                    msg_req->setMethod(method);
-                    msg_req->setHost(host);
-                    msg_req->setOptype(optype);
-                    for (auto &discover : discovers)
+                    for (auto &method : methods)
                     {
-                        discover->conn->send(msg_req);
+                        ServiceChange change;
+                        change.method = method;
+                        change.host = host;
+                        change.optype = optype;
+                        change.weight = weight;
+                        change.version = ++_version;
+                        auto it = _discoverers.find(method);
+                        if (it == _discoverers.end())
+                            continue;
+                        for (auto &discover : it->second) // 该方法对应的发现者们
+                        {
+                            discover->pending.push_back(change);
+                            _dirty.insert(discover);
+                        }
                     }
+                    if (_window != 0 || _dirty.empty())
+                        return;
                 }
+                flush();
             }
+            std::mutex _flush_mutex;
             std::mutex _mutex;
+            uint64_t _version = 0; // 注册中心的版本号
+            int _window = 0;
+            std::unordered_set<Discoverer::ptr> _dirty; // 有变化还没发出去的发现者
             // 这一个方法: 有多少发现者。因为当一个方法上线/下线的时候要通知对应的发现者
             std::unordered_map<std::string, std::set<Discoverer::ptr>> _discoverers;
             // 这个连接对应的发现者是谁
             std::unordered_map<BaseConnection::ptr, Discoverer::ptr> _conns;
         };
+        // 服务发现响应的缓存: 方法 -> 序列化好的响应正文
+        // 提供者列表很少变化，重复的服务发现请求直接复用正文，只需要换上请求的 id
+        // 方法的提供者有变化(上线 / 下线 / 通知了新权重)时作废
+        class DiscoveryCache
+        {
+        public:
+            using ptr = std::shared_ptr<DiscoveryCache>;
+            using Body = std::shared_ptr<const std::string>;
+            // 命中时返回正文; 未命中时返回空, generation 带出当前的代数，构造好响应后用它调用 put
+            // 查询不插入条目: 客户端查询不存在的方法不会让缓存变大
+            Body get(const std::string &method, uint64_t &generation)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                generation = _generation;
+                auto it = _entries.find(method);
+                if (it == _entries.end())
+                    return Body();
+                return it->second;
+            }
+            // 构造响应期间缓存被作废过(代数变了)，这份正文可能已经过时，不放入缓存
+            // 只缓存找到了提供者的响应, 缓存的条目不会多于注册过的方法
+            void put(const std::string &method, uint64_t generation, const Body &body)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_generation != generation)
+                    return;
+                _entries[method] = body;
+            }
+            // 需要在提供者表修改之后调用
+            void invalidate(const std::vector<std::string> &methods)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _generation++;
+                for (auto &method : methods)
+                    _entries.erase(method);
+            }
+            void invalidate(const std::string &method)
+            {
+                return invalidate(std::vector<std::string>{method});
+            }
+
+        private:
+            std::mutex _mutex;
+            uint64_t _generation = 0; // 每次作废都加一(不区分方法: 作废很少发生, 偶尔少放一次缓存没有关系)
+            std::unordered_map<std::string, Body> _entries;
+        };
         // 服务注册中心
         // 整合上面两个模块 : 处理分布式系统中的服务注册、服务发现以及服务上下线通知等核心功能
         class PDManager
         {
         public:
             using ptr = std::shared_ptr<PDManager>;
+            using ReplicateCallback = std::function<void(const BaseMessage::ptr &)>; // 把同步消息发给集群中的其它节点
             // 这是 PDManager 接收服务注册 / 服务发现请求的总入口
             // 所有客户端（服务提供者或消费者）发起的服务相关操作，都通过这个接口进入处理流程
             PDManager()
                 : _providers(std::make_shared<ProviderManager>()),
-                  _discoverers(std::make_shared<DiscovererManager>())
+                  _discoverers(std::make_shared<DiscovererManager>()),
+                  _cache(std::make_shared<DiscoveryCache>())
             {
             }
             void onServiceRequest(const BaseConnection::ptr conn, const ServiceRequest::ptr &svr_req)
@@ -215,11 +599,27 @@ namespace TrRpc
                     // 服务注册：
                     //  1. 新增服务提供者；  2. 进行服务上线的通知
                     INF_LOG("%s:%d 注册服务 %s", svr_req->host().first.c_str(), svr_req->host().second, svr_req->method().c_str());
-                    _providers->addProvider(conn, svr_req->host(), svr_req->method());
-                    _discoverers->onlineNotify(svr_req->method(), svr_req->host());
+                    auto provider = _providers->addProvider(conn, svr_req->host(), svr_req->method());
+                    _cache->invalidate(svr_req->method());
+                    int weight = _providers->weight(provider);
+                    _discoverers->onlineNotify(svr_req->method(), svr_req->host(), weight);
+                    replicate(ServiceOptype::SERVICE_REPLICA_ONLINE, svr_req->method(), svr_req->host(), weight);
                     // 服务端还需要生成响应
                     return registryResponse(conn, svr_req);
                 }
+                else if (optype == ServiceOptype::SERVICE_BULK_REGISTRY)
+                {
+                    // 批量注册: 所有方法一次性加入，每个发现者只收到一条上线通知，只回复一个响应
+                    auto methods = svr_req->methods();
+                    INF_LOG("%s:%d 批量注册 %d 个服务", svr_req->host().first.c_str(), svr_req->host().second, (int)methods.size());
+                    auto provider = _providers->addProvider(conn, svr_req->host(), methods);
+                    _cache->invalidate(methods);
+                    int weight = _providers->weight(provider);
+                    _discoverers->onlineNotify(methods, svr_req->host(), weight);
+                    for (auto &method : methods)
+                        replicate(ServiceOptype::SERVICE_REPLICA_ONLINE, method, svr_req->host(), weight);
+                    return registryResponse(conn, svr_req);
+                }
                 else if (optype == ServiceOptype::SERVICE_DISCOVERY)
                 {
                     // 服务发现：
@@ -228,6 +628,38 @@ namespace TrRpc
                     _discoverers->addDiscoverer(conn, svr_req->method());
                     return discoveryResponse(conn, svr_req);
                 }
+                else if (optype == ServiceOptype::SERVICE_LOAD)
+                {
+                    // 负载上报: 更新权重(不需要响应)
+                    // 权重变化明显时，通过上线通知把新权重告诉关心这些方法的发现者
+                    int old_weight = 0, new_weight = 0;
+                    auto provider = _providers->updateLoad(conn, svr_req->load(), old_weight, new_weight);
+                    if (provider == nullptr)
+                        return;
+                    DBG_LOG("%s:%d 负载上报, 权重 %d -> %d", provider->host.first.c_str(), provider->host.second, old_weight, new_weight);
+                    if (std::abs(new_weight - old_weight) < weightNotifyDelta)
+                        return;
+                    auto methods = _providers->methods(provider);
+                    _cache->invalidate(methods);
+                    _discoverers->onlineNotify(methods, provider->host, new_weight);
+                    for (auto &method : methods)
+                        replicate(ServiceOptype::SERVICE_REPLICA_ONLINE, method, provider->host, new_weight);
+                }
+                else if (optype == ServiceOptype::SERVICE_REPLICA_ONLINE)
+                {
+                    // 其它节点同步过来的提供者上线(或权重变化): 通知本节点的发现者，不需要响应，也不再转发
+                    _providers->addReplica(conn, svr_req->host(), svr_req->method(), svr_req->weight());
+                    _cache->invalidate(svr_req->method());
+                    _discoverers->onlineNotify(svr_req->method(), svr_req->host(), svr_req->weight());
+                }
+                else if (optype == ServiceOptype::SERVICE_REPLICA_OFFLINE)
+                {
+                    if (_providers->delReplica(conn, svr_req->host(), svr_req->method()))
+                    {
+                        _cache->invalidate(svr_req->method());
+                        _discoverers->offlineNotify(svr_req->method(), svr_req->host());
+                    }
+                }
                 else
                 {
                     ERR_LOG("收到服务操作请求，但是操作类型错误！");
@@ -240,21 +672,100 @@ namespace TrRpc
             {
                 // 不知道是服务提供者的连接关闭了，还是服务发现者的连接关闭了
                 // 并且: 一个服务有可能即是服务发现者又是服务提供者
-                auto provider = _providers->getProvider(conn);
-                if (provider != nullptr) // 代表是服务提供者的连接关闭了
+                // 1. 删除服务提供者   2. 服务下线通知
+                // 先删除再通知: 保证拿到某个版本号的服务发现响应中，已经不包含这个版本之前下线的主机
+                ProviderRecord provider;
+                if (_providers->delProvider(conn, provider)) // 代表是服务提供者的连接关闭了
                 {
-                    // 1. 服务下线通知   2. 删除服务提供者
-                    INF_LOG("%s:%d 服务下线", provider->host.first.c_str(), provider->host.second);
-                    for (auto &method : provider->methods)
-                    {
-                        _discoverers->offlineNotify(method, provider->host);
-                    }
-                    _providers->delProvider(conn);
+                    INF_LOG("%s:%d 服务下线", provider.host.first.c_str(), provider.host.second);
+                    _cache->invalidate(provider.methods);
+                    _discoverers->offlineNotify(provider.methods, provider.host);
+                    for (auto &method : provider.methods)
+                        replicate(ServiceOptype::SERVICE_REPLICA_OFFLINE, method, provider.host);
+                }
+                // 集群中其它节点的连接断开了，它同步过来的提供者都按下线处理(这些提供者会重新连到还活着的节点上注册)
+                for (auto &replica : _providers->delReplicas(conn))
+                {
+                    INF_LOG("%s:%d 所在的注册中心节点断开，服务下线", replica.host.first.c_str(), replica.host.second);
+                    _cache->invalidate(replica.methods);
+                    _discoverers->offlineNotify(replica.methods, replica.host);
                 }
                 _discoverers->delDiscoverer(conn);
             }
+            // 上下线通知的合并窗口(ms)，需要在启动前设置
+            void setNotifyWindow(int ms)
+            {
+                _discoverers->setWindow(ms);
+            }
+            // 是否缓存服务发现响应(默认开启)，需要在启动前设置
+            void setDiscoveryCache(bool enable)
+            {
+                _cache_enabled = enable;
+            }
+            // 由定时器周期性调用，发出合并后的增量通知
+            void flushNotify()
+            {
+                _discoverers->flush();
+            }
+            // 集群模式: 设置向其它节点同步的回调(需要在启动前设置)
+            void setReplicateCallback(const ReplicateCallback &cb)
+            {
+                _replicate = cb;
+            }
+            // 连上了集群中的某个节点: 把本节点的所有提供者同步过去(对端收到重复的上线消息时只会更新权重)
+            void syncTo(const BaseConnection::ptr &peer)
+            {
+                for (auto &record : _providers->records(false))
+                {
+                    for (auto &method : record.methods)
+                        peer->send(replicaRequest(ServiceOptype::SERVICE_REPLICA_ONLINE, method, record.host, record.weight));
+                }
+            }
+            // 启动时加载快照: 快照中的提供者立即可以被发现，lease 时间内需要重新注册确认
+            bool loadSnapshot(const std::string &path, std::chrono::milliseconds lease)
+            {
+                std::vector<ProviderRecord> records;
+                if (RegistrySnapshot::load(path, records) == false)
+                    return false;
+                _providers->restore(records, lease);
+                _saved_version = _providers->version();
+                INF_LOG("从快照 %s 恢复了 %d 个服务提供者", path.c_str(), (int)records.size());
+                return true;
+            }
+            // 周期性调用: 清理到期的租约(通知下线)，提供者表有变化时写快照
+            void onSnapshotTimer(const std::string &path)
+            {
+                for (auto &provider : _providers->expireLeases())
+                {
+                    INF_LOG("%s:%d 租约到期，服务下线", provider.host.first.c_str(), provider.host.second);
+                    _cache->invalidate(provider.methods);
+                    _discoverers->offlineNotify(provider.methods, provider.host);
+                }
+                uint64_t version = _providers->version();
+                if (version == _saved_version)
+                    return;
+                if (RegistrySnapshot::save(path, _providers->records()))
+                    _saved_version = version;
+            }
 
         private:
+            void replicate(ServiceOptype optype, const std::string &method, const Address &host, int weight = DEFAULT_WEIGHT)
+            {
+                if (_replicate)
+                    _replicate(replicaRequest(optype, method, host, weight));
+            }
+            ServiceRequest::ptr replicaRequest(ServiceOptype optype, const std::string &method, const Address &host, int weight)
+            {
+                auto msg_req = MessageFactory::create<ServiceRequest>();
+                msg_req->setId(UUid::uuid());
+                msg_req->setMtype(MType::REQ_SERVICE);
+                msg_req->setMethod(method);
+                msg_req->setHost(host);
+                msg_req->setOptype(optype);
+                if (optype == ServiceOptype::SERVICE_REPLICA_ONLINE)
+                    msg_req->setWeight(weight);
+                return msg_req;
+            }
             void registryResponse(const BaseConnection::ptr conn, const ServiceRequest::ptr &svr_req)
             {
                 auto svr_rsp = MessageFactory::create<ServiceResponse>();
@@ -265,22 +776,47 @@ namespace TrRpc
                 conn->send(svr_rsp);
             }
 
+            // 开启缓存时: 命中直接发送缓存的正文; 未命中时构造、序列化一次响应并放入缓存
             void discoveryResponse(const BaseConnection::ptr conn, const ServiceRequest::ptr &svr_req)
+            {
+                if (_cache_enabled == false)
+                {
+                    auto svr_rsp = discoveryMessage(svr_req->method());
+                    svr_rsp->setId(svr_req->rid());
+                    return conn->send(svr_rsp);
+                }
+                uint64_t generation = 0;
+                DiscoveryCache::Body body = _cache->get(svr_req->method(), generation);
+                if (body == nullptr)
+                {
+                    auto svr_rsp = discoveryMessage(svr_req->method());
+                    body = std::make_shared<const std::string>(svr_rsp->serialize());
+                    if (svr_rsp->rcode() == RCode::RCODE_OK)
+                        _cache->put(svr_req->method(), generation, body);
+                }
+                auto msg = MessageFactory::create<EncodedMessage>(MType::RSP_SERVICE, body);
+                msg->setId(svr_req->rid());
+                conn->send(msg);
+            }
+            // 构造服务发现响应(不含 id)
+            ServiceResponse::ptr discoveryMessage(const std::string &method)
             {
                 auto svr_rsp = MessageFactory::create<ServiceResponse>();
-                svr_rsp->setId(svr_req->rid());
                 svr_rsp->setMtype(MType::RSP_SERVICE);
                 svr_rsp->setOptype(ServiceOptype::SERVICE_DISCOVERY);
-                std::vector<Address> hosts = _providers->methodHosts(svr_req->method());
+                // 先取版本号再取提供者列表: 版本号不大于它的变化一定已经反映在列表中了
+                svr_rsp->setVersion(_discoverers->version());
+                std::vector<int> weights;
+                std::vector<Address> hosts = _providers->methodHosts(method, &weights);
                 if (hosts.empty())
                 {
                     svr_rsp->setRcode(RCode::RCODE_NOT_FOUND_SERVICE);
-                    return conn->send(svr_rsp);
+                    return svr_rsp;
                 }
-                svr_rsp->setMethod(svr_req->method());
-                svr_rsp->setHost(hosts);
+                svr_rsp->setMethod(method);
+                svr_rsp->setHost(hosts, weights);
                 svr_rsp->setRcode(RCode::RCODE_OK);
-                return conn->send(svr_rsp);
+                return svr_rsp;
             }
             void errorResponse(const BaseConnection::ptr &conn, const ServiceRequest::ptr &svr_req)
             {
@@ -293,8 +829,13 @@ namespace TrRpc
             }
 
         private:
+            const int weightNotifyDelta = 10; // 权重变化超过这个值才通知发现者，避免频繁通知
+            uint64_t _saved_version = 0;      // 最近一次写入快照时提供者表的版本(只在定时器中访问)
+            ReplicateCallback _replicate;     // 集群模式下向其它节点同步，单节点时为空
+            bool _cache_enabled = true;
             ProviderManager::ptr _providers;
             DiscovererManager::ptr _discoverers;
+            DiscoveryCache::ptr _cache;
         };
     }
 }
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
 #include "../common/net.hpp"
 #include "../common/message.hpp"
+#include <atomic>
+#include <thread>
+#include <sys/resource.h>
 
 namespace TrRpc
 {
@@ -171,17 +174,88 @@ namespace TrRpc
         // 同时还需要解析参数，确保参数匹配，还可以确保返回值匹配
         // 因此：方法名,参数列表, 回调接口, 返回值。带有多成员，我们也可以封装成一个类(服务描述)
         // 建立根据方法名，直接到一整个 服务描述的映射，通过服务描述类完成：参数校验，回调等功能
+        // 负载统计: 统计正在处理的请求数、请求总数，采样时算出 qps 和进程 cpu 使用率，用于向注册中心上报负载
+        class LoadMeter
+        {
+        public:
+            using ptr = std::shared_ptr<LoadMeter>;
+            // 在请求处理期间存在，构造时计数 +1，析构时 -1
+            class Guard
+            {
+            public:
+                Guard(LoadMeter &meter) : _meter(meter) { _meter.begin(); }
+                ~Guard() { _meter.end(); }
+
+            private:
+                LoadMeter &_meter;
+            };
+            LoadMeter()
+                : _inflight(0), _total(0), _last_total(0),
+                  _last_wall(std::chrono::steady_clock::now()), _last_cpu(cpuTime()) {}
+            void begin()
+            {
+                _inflight++;
+                _total++;
+            }
+            void end()
+            {
+                _inflight--;
+            }
+            // 采样: qps 和 cpu 都是相对于上一次采样的平均值，由上报定时器周期性调用
+            LoadInfo sample()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto now = std::chrono::steady_clock::now();
+                double cpu_now = cpuTime();
+                uint64_t total = _total;
+                double wall = std::chrono::duration<double>(now - _last_wall).count();
+                LoadInfo load;
+                load.inflight = _inflight;
+                if (wall > 0)
+                {
+                    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+                    load.qps = (total - _last_total) / wall;
+                    load.cpu = std::min(100.0, (cpu_now - _last_cpu) / wall / cores * 100);
+                }
+                _last_wall = now;
+                _last_cpu = cpu_now;
+                _last_total = total;
+                return load;
+            }
+
+        private:
+            // 进程累计使用的 cpu 时间(用户态 + 内核态, 秒)
+            static double cpuTime()
+            {
+                struct rusage usage;
+                if (getrusage(RUSAGE_SELF, &usage) != 0)
+                    return 0;
+                return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                       usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+            }
+
+        private:
+            std::atomic<int> _inflight;
+            std::atomic<uint64_t> _total;
+            std::mutex _mutex; // 保护下面的采样状态
+            uint64_t _last_total;
+            std::chrono::steady_clock::time_point _last_wall;
+            double _last_cpu;
+        };
+
         class RpcRouter
         {
         public:
             using ptr = std::shared_ptr<RpcRouter>;
             RpcRouter()
-                : _service_manager(std::make_shared<ServiceManager>())
+                : _service_manager(std::make_shared<ServiceManager>()),
+                  _load_meter(std::make_shared<LoadMeter>())
             {
             }
             // 这是设置给 Dispatcher 模块的针对 Rpc 请求进行回调处理的业务函数
             void onRpcRequest(BaseConnection::ptr &conn, RpcRequest::ptr &req)
             {
+                LoadMeter::Guard guard(*_load_meter); // 统计负载
                 // 1. 根据请求名称查找请求方法
                 ServiceDescribe::ptr desc = _service_manager->select(req->method());
                 if (desc.get() == nullptr)
@@ -212,6 +286,11 @@ namespace TrRpc
             {
                 _service_manager->insert(service);
             }
+            // 当前负载采样(用于向注册中心上报)
+            LoadInfo sampleLoad()
+            {
+                return _load_meter->sample();
+            }
 
         private:
             // 根据结果组织响应 + 发送给客户端
@@ -229,6 +308,7 @@ namespace TrRpc
 
         private:
             ServiceManager::ptr _service_manager;
+            LoadMeter::ptr _load_meter;
         };
     }
 }
@@ -2,6 +2,7 @@
 #include "../common/net.hpp"
 #include "../common/dispatcher.hpp"
 #include "rpc_registry.hpp"
+#include "rpc_cluster.hpp"
 #include "../client/rpc_client.hpp"
 #include "rpc_router.hpp"
 #include "rpc_topic.hpp"
@@ -31,12 +32,69 @@ namespace TrRpc
                 auto close_cb = std::bind(&PDManager::onConnShutdown, _pd_manager.get(), std::placeholders::_1);
                 _server->SetCloseCallback(close_cb);
             }
+            // 空闲超时(秒): 超时没有任何数据(包括心跳)的连接会被关闭，并按连接断开处理(服务下线)
+            void setIdleTimeout(int sec)
+            {
+                _server->setIdleTimeout(sec);
+            }
+            // I/O 线程数: 连接分散到多个 loop 上，通知也由各 loop 并行发送; 需要在 Start 之前设置
+            void setThreadNum(int num)
+            {
+                _server->setThreadNum(num);
+            }
+            // 上下线通知的合并窗口(ms): 窗口内的变化对每个发现者只发一条增量通知，0 表示立即发送
+            void setNotifyWindow(int ms)
+            {
+                _notify_window = ms;
+            }
+            // 是否缓存服务发现响应(默认开启): 提供者没有变化时，重复的服务发现请求不再重新构造和序列化响应
+            void setDiscoveryCache(bool enable)
+            {
+                _pd_manager->setDiscoveryCache(enable);
+            }
+            // 集群模式: 添加集群中的其它节点(每个节点都要添加其它所有节点), 需要在 Start 之前调用
+            // 各节点互相同步直接连在自己身上的服务提供者，客户端可以连接任意一个节点进行服务发现
+            void addPeer(const Address &peer)
+            {
+                _peer_addrs.push_back(peer);
+            }
+            // 开启快照: 每隔 interval 秒把服务提供者表写到 path(有变化时才写)
+            // 重启时先从快照恢复，服务发现立即可用; 恢复出来的提供者需要在 lease 秒内重新注册，否则按下线处理
+            void enableSnapshot(const std::string &path, int interval = 5, int lease = 30)
+            {
+                _snapshot_path = path;
+                _snapshot_interval = interval;
+                _lease = lease;
+            }
             void Start()
             {
+                _pd_manager->setNotifyWindow(_notify_window);
+                if (_notify_window > 0)
+                    _server->runEvery(_notify_window / 1000.0, std::bind(&PDManager::flushNotify, _pd_manager));
+                if (_snapshot_path.empty() == false)
+                {
+                    _pd_manager->loadSnapshot(_snapshot_path, std::chrono::seconds(_lease));
+                    // 写快照在主 loop 中进行，文件很小，不会影响连接的建立
+                    _server->runEvery(_snapshot_interval, std::bind(&PDManager::onSnapshotTimer, _pd_manager, _snapshot_path));
+                }
+                if (_peer_addrs.empty() == false)
+                {
+                    auto sync_cb = std::bind(&PDManager::syncTo, _pd_manager, std::placeholders::_1);
+                    _peers = std::make_shared<RegistryPeers>(_peer_addrs, sync_cb);
+                    _pd_manager->setReplicateCallback(std::bind(&RegistryPeers::broadcast, _peers, std::placeholders::_1));
+                    _peers->start();
+                    _server->runEvery(1.0, std::bind(&RegistryPeers::check, _peers));
+                }
                 _server->start();
             }
 
         private:
+            int _notify_window = 50;
+            std::vector<Address> _peer_addrs; // 集群中的其它节点
+            RegistryPeers::ptr _peers;
+            std::string _snapshot_path; // 为空表示不开启快照
+            int _snapshot_interval = 5;
+            int _lease = 30;
             PDManager::ptr _pd_manager;  // 注册中心，处理业务的模块
             Dispatcher::ptr _dispatcher; // 分发模块，需要给底层网络层设置回调的
             BaseServer::ptr _server;     // 网络服务端
@@ -51,13 +109,17 @@ namespace TrRpc
             //  1. rpc服务提供端地址信息--必须是 rpc 服务器对外访问地址（云服务器---监听地址和访问地址不同）
             //  2. 注册中心服务端地址信息 -- 启用服务注册后，连接注册中心进行服务注册用的
             RpcServer(Address access_addr, Address reg_server_addr = Address(), bool enablediscover = false)
-                : _access_addr(access_addr), _enableRegistry(enablediscover),
+                : RpcServer(access_addr, enablediscover ? std::vector<Address>{reg_server_addr} : std::vector<Address>())
+            {
+            }
+            // 注册中心是一个集群: reg_nodes 是各节点的地址, 为空表示不启用服务注册
+            RpcServer(Address access_addr, const std::vector<Address> &reg_nodes)
+                : _access_addr(access_addr), _enableRegistry(!reg_nodes.empty()),
                   _dispatcher(std::make_shared<Dispatcher>()), _router(std::make_shared<RpcRouter>())
-
             {
                 // 是否将方法注册到 注册中心，如果是: 则自己也是身为注册的客户端的
                 if (_enableRegistry == true)
-                    _reg_client = std::make_shared<client::RegistryClient>(reg_server_addr.first, reg_server_addr.second);
+                    _reg_client = std::make_shared<client::RegistryClient>(reg_nodes);
                 // 当前成员server是一个rpcserver，用于提供rpc服务的
                 auto rpc_cb = std::bind(&RpcRouter::onRpcRequest, _router.get(), std::placeholders::_1, std::placeholders::_2);
                 _dispatcher->registerHandler<RpcRequest>(MType::REQ_RPC, rpc_cb);
@@ -66,22 +128,66 @@ namespace TrRpc
                 auto message_cb = std::bind(&Dispatcher::OnMessage, _dispatcher.get(), std::placeholders::_1, std::placeholders::_2);
                 _server->SetMessageCallback(message_cb);
             }
+            // start 之前注册的方法先攒起来，start 时用一个批量请求注册到注册中心(一次往返, 发现者只收到一条上线通知)
+            // start 之后注册的方法立即注册到注册中心
             void registerMethod(const ServiceDescribe::ptr &service)
             {
+                _router->regeisterMethod(service); // 方法注册到本地
                 if (_enableRegistry) // 方法注册到注册中心
                 {
-                    _reg_client->serviceRegistry(service->method(), _access_addr);
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if (_started == false)
+                    {
+                        _pending_methods.push_back(service->method());
+                        return;
+                    }
+                    lock.unlock();
+                    if (_reg_client->serviceRegistry(service->method(), _access_addr) == false)
+                        ERR_LOG("方法 %s 注册到注册中心失败, 连接上注册中心节点后会重新注册", service->method().c_str());
                 }
-                _router->regeisterMethod(service); // 方法注册到本地
+            }
+            void setIdleTimeout(int sec)
+            {
+                _server->setIdleTimeout(sec);
+            }
+            // 负载上报间隔(秒)，0 表示不上报; 需要在 start 之前设置
+            void setLoadReportInterval(double sec)
+            {
+                _load_report_interval = sec;
             }
             void start()
             {
+                if (_enableRegistry)
+                {
+                    std::vector<std::string> methods;
+                    {
+                        std::unique_lock<std::mutex> lock(_mutex);
+                        _started = true;
+                        methods.swap(_pending_methods);
+                    }
+                    // 注册中心没有启动 或者 响应太慢时注册失败: 服务照常启动, 连接上(切换到)注册中心节点后自动重新注册
+                    if (_reg_client->serviceRegistry(methods, _access_addr) == false)
+                        ERR_LOG("启动时向注册中心注册 %zu 个方法失败, 连接上注册中心节点后会重新注册", methods.size());
+                }
+                // 启用了服务注册: 定期把负载上报给注册中心，注册中心据此调整本主机被选中的权重
+                if (_enableRegistry && _load_report_interval > 0)
+                {
+                    std::weak_ptr<RpcRouter> weak_router = _router;
+                    _reg_client->startLoadReport(_access_addr, _load_report_interval, [weak_router]()
+                                                 {
+                                                     auto router = weak_router.lock();
+                                                     return router ? router->sampleLoad() : LoadInfo(); });
+                }
                 _server->start();
             }
 
         private:
             Address _access_addr; // rpc服务器对外访问地址(云服务器)
             bool _enableRegistry; // Rpc服务器，是否将自己能提供的Rpc调用服务注册到 注册中心
+            double _load_report_interval = 5;
+            std::mutex _mutex;
+            bool _started = false;
+            std::vector<std::string> _pending_methods; // start 之前注册、等待批量注册到注册中心的方法
             client::RegistryClient::ptr _reg_client;
             Dispatcher::ptr _dispatcher;
             RpcRouter::ptr _router;
@@ -100,18 +206,54 @@ namespace TrRpc
             {
                 auto topic_cb = std::bind(&TopicManager::onTopicRequest, _topic_manager.get(), std::placeholders::_1, std::placeholders::_2);
                 _dispatcher->registerHandler<TopicRequest>(MType::REQ_TOPIC, topic_cb);
+                auto binary_cb = std::bind(&TopicManager::onBinaryPublish, _topic_manager.get(), std::placeholders::_1, std::placeholders::_2);
+                _dispatcher->registerHandler<BinaryTopicMessage>(MType::REQ_TOPIC_BINARY, binary_cb);
                 auto message_cb = std::bind(&Dispatcher::OnMessage, _dispatcher.get(), std::placeholders::_1, std::placeholders::_2);
                 _server->SetMessageCallback(message_cb);
                 // 设置关闭回调(调用 pd_manager 的 shutdown, 把该关的关了，管理好自己的成员)
                 auto close_cb = std::bind(&TopicManager::onShutdown, _topic_manager.get(), std::placeholders::_1);
                 _server->SetCloseCallback(close_cb);
             }
+            // 空闲超时(秒): 超时没有任何数据(包括心跳)的订阅者连接会被关闭，并清理其订阅信息
+            void setIdleTimeout(int sec)
+            {
+                _server->setIdleTimeout(sec);
+            }
+            // I/O 线程数: 订阅者分布在多个 loop 上时, 同一条消息由各个 loop 并行推送; 需要在 Start 之前设置
+            void setThreadNum(int num)
+            {
+                _server->setThreadNum(num);
+            }
+            // 每个订阅者的发送队列最多缓存多少条消息(默认 4096), 满了之后按主题创建时指定的策略处理
+            void setMaxQueue(size_t max_queue)
+            {
+                _topic_manager->setMaxQueue(max_queue);
+            }
+            // 开启持久化主题: 创建时指定了 durable 的主题, 消息写入 dir 下的内存映射日志分段, 重启后可以从任意还保留着的序号重放
+            // 日志总大小超过 max_bytes 或者 分段中的消息早于 max_age 秒之前时清理最旧的分段(0 表示不限制)
+            void enableLog(const std::string &dir, size_t segment_size = 64 << 20, size_t max_bytes = 0, int max_age = 0)
+            {
+                _topic_manager->enableLog(dir, segment_size, max_bytes, max_age);
+                _log_enabled = true;
+            }
+            // 主题的统计信息(发布数 / 因订阅者太慢丢弃的消息数)
+            bool topicStats(const std::string &topic_name, TopicStats &stats)
+            {
+                return _topic_manager->topicStats(topic_name, stats);
+            }
             void Start()
             {
+                if (_log_enabled)
+                {
+                    _topic_manager->recoverLogs();
+                    // 每秒清理过期分段、刷盘、保存消费位置
+                    _server->runEvery(1.0, std::bind(&TopicManager::onLogTimer, _topic_manager));
+                }
                 _server->start();
             }
 
         private:
+            bool _log_enabled = false;
             TopicManager::ptr _topic_manager;
             Dispatcher::ptr _dispatcher;    
             BaseServer::ptr _server;        
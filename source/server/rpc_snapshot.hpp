@@ -0,0 +1,173 @@
+#pragma once
+#include "../common/mmap.hpp"
+#include "../common/message.hpp"
+#include <cstdio>
+#include <vector>
+
+namespace TrRpc
+{
+    namespace server
+    {
+        // 快照中的一个服务提供者: 主机 + 权重 + 提供的方法
+        struct ProviderRecord
+        {
+            Address host;
+            int weight = DEFAULT_WEIGHT;
+            std::vector<std::string> methods;
+        };
+
+        // 注册中心的服务提供者表快照(紧凑的二进制格式, 通过 mmap 读写)
+        // |--magic--|--version--|--count--|--body_len--|--checksum--|--records...--|
+        // record: |--iplen(2)--|--ip--|--port(2)--|--weight(2)--|--method_count(2)--|--(len(2)--|--method--)...--|
+        // 写入时先写临时文件再 rename, 保证任何时刻磁盘上的快照都是完整的
+        class RegistrySnapshot
+        {
+        public:
+            static bool save(const std::string &path, const std::vector<ProviderRecord> &records)
+            {
+                std::string body;
+                for (auto &record : records)
+                {
+                    putString(body, record.host.first);
+                    putU16(body, record.host.second);
+                    putU16(body, record.weight);
+                    putU16(body, record.methods.size());
+                    for (auto &method : record.methods)
+                        putString(body, method);
+                }
+                Header header;
+                header.magic = snapshotMagic;
+                header.version = snapshotVersion;
+                header.count = records.size();
+                header.body_len = body.size();
+                header.checksum = checksum(body.data(), body.size());
+
+                std::string tmp = path + ".tmp";
+                MmapFile file;
+                if (file.openWrite(tmp, sizeof(Header) + body.size()) == false)
+                    return false;
+                memcpy(file.data(), &header, sizeof(Header));
+                memcpy(file.data() + sizeof(Header), body.data(), body.size());
+                bool ret = file.sync();
+                file.close();
+                if (ret == false || ::rename(tmp.c_str(), path.c_str()) != 0)
+                {
+                    ERR_LOG("写入注册中心快照 %s 失败", path.c_str());
+                    return false;
+                }
+                return true;
+            }
+            // 读取快照, 文件不存在或者内容不完整时返回 false
+            static bool load(const std::string &path, std::vector<ProviderRecord> &records)
+            {
+                MmapFile file;
+                if (file.openRead(path) == false)
+                    return false;
+                if (file.size() < sizeof(Header))
+                {
+                    ERR_LOG("注册中心快照 %s 格式错误", path.c_str());
+                    return false;
+                }
+                Header header;
+                memcpy(&header, file.data(), sizeof(Header));
+                const char *body = file.data() + sizeof(Header);
+                if (header.magic != snapshotMagic || header.version != snapshotVersion ||
+                    header.body_len != file.size() - sizeof(Header) ||
+                    header.checksum != checksum(body, header.body_len))
+                {
+                    ERR_LOG("注册中心快照 %s 已损坏", path.c_str());
+                    return false;
+                }
+                Reader reader(body, header.body_len);
+                std::vector<ProviderRecord> result;
+                for (uint32_t i = 0; i < header.count; i++)
+                {
+                    ProviderRecord record;
+                    uint16_t port = 0, weight = 0, count = 0;
+                    if (!reader.getString(record.host.first) || !reader.getU16(port) ||
+                        !reader.getU16(weight) || !reader.getU16(count))
+                        break;
+                    record.host.second = port;
+                    record.weight = weight;
+                    std::string method;
+                    for (uint16_t j = 0; j < count && reader.getString(method); j++)
+                        record.methods.push_back(method);
+                    if (record.methods.size() != count)
+                        break;
+                    result.push_back(std::move(record));
+                }
+                if (result.size() != header.count)
+                {
+                    ERR_LOG("注册中心快照 %s 内容不完整", path.c_str());
+                    return false;
+                }
+                records.swap(result);
+                return true;
+            }
+
+        private:
+            struct Header
+            {
+                uint32_t magic;
+                uint32_t version;
+                uint32_t count;
+                uint32_t body_len;
+                uint32_t checksum;
+            };
+            enum
+            {
+                snapshotMagic = 0x53525254, // "TRRS"
+                snapshotVersion = 1
+            };
+            // 按字节顺序读取 body, 越界时返回 false
+            class Reader
+            {
+            public:
+                Reader(const char *data, size_t len) : _data(data), _len(len), _pos(0) {}
+                bool getU16(uint16_t &val)
+                {
+                    if (_pos + 2 > _len)
+                        return false;
+                    val = (uint8_t)_data[_pos] | ((uint8_t)_data[_pos + 1] << 8);
+                    _pos += 2;
+                    return true;
+                }
+                bool getString(std::string &str)
+                {
+                    uint16_t len = 0;
+                    if (getU16(len) == false || _pos + len > _len)
+                        return false;
+                    str.assign(_data + _pos, len);
+                    _pos += len;
+                    return true;
+                }
+
+            private:
+                const char *_data;
+                size_t _len;
+                size_t _pos;
+            };
+            static void putU16(std::string &out, uint32_t val)
+            {
+                out.push_back((char)(val & 0xff));
+                out.push_back((char)((val >> 8) & 0xff));
+            }
+            static void putString(std::string &out, const std::string &str)
+            {
+                putU16(out, str.size());
+                out.append(str);
+            }
+            // FNV-1a, 用来发现写了一半或者被改坏的文件
+            static uint32_t checksum(const char *data, size_t len)
+            {
+                uint32_t hash = 2166136261u;
+                for (size_t i = 0; i < len; i++)
+                {
+                    hash ^= (uint8_t)data[i];
+                    hash *= 16777619u;
+                }
+                return hash;
+            }
+        };
+    }
+}
@@ -1,25 +1,196 @@
 #pragma once
 #include "../common/net.hpp"
+#include "topic_log.hpp"
 #include <unordered_set>
+#include <deque>
 
 namespace TrRpc
 {
     namespace server
     {
+        // 主题的统计信息
+        struct TopicStats
+        {
+            size_t subscribers = 0; // 直接订阅的订阅者个数(不包括通配订阅)
+            uint64_t published = 0; // 发布到这个主题的消息数
+            uint64_t dropped = 0;   // 因为订阅者发送队列满了而丢弃的消息数(每个订阅者丢一次算一次)
+            uint64_t log_failed = 0; // 持久化主题写日志失败的次数(这些消息照常推送, 但是不能重放)
+        };
+        // 按 key 的哈希分成多个分片的 map, 每个分片一把锁
+        // 不同 key 的操作大多落在不同的分片上, 多个 I/O 线程同时操作不相关的主题时不会互相等待
+        template <typename K, typename V>
+        class ShardedMap
+        {
+        public:
+            // 不存在时返回空的 V
+            V find(const K &key)
+            {
+                Shard &s = shard(key);
+                std::unique_lock<std::mutex> lock(s.mutex);
+                auto it = s.map.find(key);
+                return it == s.map.end() ? V() : it->second;
+            }
+            bool contains(const K &key)
+            {
+                Shard &s = shard(key);
+                std::unique_lock<std::mutex> lock(s.mutex);
+                return s.map.count(key) > 0;
+            }
+            // 已经存在时不覆盖, 返回 false
+            bool insert(const K &key, const V &value)
+            {
+                Shard &s = shard(key);
+                std::unique_lock<std::mutex> lock(s.mutex);
+                return s.map.emplace(key, value).second;
+            }
+            // 不存在时调用 create() 创建一个插入, 返回 map 中的值
+            // create() 在分片的锁内调用; 它返回空的 V 时表示创建失败, 不插入, 返回空的 V
+            template <typename F>
+            V findOrCreate(const K &key, const F &create)
+            {
+                Shard &s = shard(key);
+                std::unique_lock<std::mutex> lock(s.mutex);
+                auto it = s.map.find(key);
+                if (it != s.map.end())
+                    return it->second;
+                V value = create();
+                if (value)
+                    s.map.emplace(key, value);
+                return value;
+            }
+            // 删除并返回被删除的值(不存在时返回空的 V)
+            V erase(const K &key)
+            {
+                Shard &s = shard(key);
+                std::unique_lock<std::mutex> lock(s.mutex);
+                auto it = s.map.find(key);
+                if (it == s.map.end())
+                    return V();
+                V value = it->second;
+                s.map.erase(it);
+                return value;
+            }
+            // 对每个元素调用 f(key, value), 一次只锁一个分片
+            template <typename F>
+            void forEach(const F &f)
+            {
+                for (auto &s : _shards)
+                {
+                    std::unique_lock<std::mutex> lock(s.mutex);
+                    for (auto &it : s.map)
+                        f(it.first, it.second);
+                }
+            }
+
+        private:
+            enum
+            {
+                shardBits = 6 // 64 个分片
+            };
+            struct Shard
+            {
+                std::mutex mutex;
+                std::unordered_map<K, V> map;
+            };
+            Shard &shard(const K &key)
+            {
+                // 乘一个奇数常量把低位打散(指针的低几位总是 0), 取最高的几位作为分片号
+                uint64_t hash = (uint64_t)std::hash<K>()(key) * 0x9E3779B97F4A7C15ull;
+                return _shards[hash >> (64 - shardBits)];
+            }
+            Shard _shards[1 << shardBits];
+        };
         class TopicManager
         {
         public:
             using ptr = std::shared_ptr<TopicManager>;
+            // 每个订阅者的发送队列最多缓存多少条消息, 需要在启动前设置
+            void setMaxQueue(size_t max_queue)
+            {
+                _max_queue = max_queue;
+            }
+            // 开启持久化主题: 创建时指定了 durable 的主题, 消息写入 dir 下的日志(每个主题一个子目录), 需要在启动前设置
+            // segment_size: 每个日志分段文件的大小; max_bytes / max_age(秒): 超过时清理最旧的分段, 0 表示不限制
+            void enableLog(const std::string &dir, size_t segment_size, size_t max_bytes, int max_age)
+            {
+                _log_dir = dir;
+                _segment_size = segment_size;
+                _log_max_bytes = max_bytes;
+                _log_max_age = max_age;
+            }
+            // 启动时调用: 重新创建日志目录中保存的持久化主题, 序号接着上次的继续
+            void recoverLogs()
+            {
+                if (::mkdir(_log_dir.c_str(), 0755) < 0 && errno != EEXIST)
+                {
+                    ERR_LOG("创建主题日志目录 %s 失败: %s", _log_dir.c_str(), strerror(errno));
+                    return;
+                }
+                DIR *dir = ::opendir(_log_dir.c_str());
+                if (dir == nullptr)
+                    return;
+                std::vector<std::string> names;
+                while (struct dirent *ent = ::readdir(dir))
+                {
+                    if (ent->d_name[0] != '.')
+                        names.push_back(ent->d_name);
+                }
+                ::closedir(dir);
+                for (auto &name : names)
+                {
+                    auto log = std::make_shared<TopicLog>(_log_dir + "/" + name, _segment_size);
+                    std::string meta;
+                    int policy = 0, pos = 0;
+                    size_t retain = 0;
+                    if (log->loadMeta(meta) == false || sscanf(meta.c_str(), "%d %zu %n", &policy, &retain, &pos) != 2 || log->open() == false)
+                    {
+                        ERR_LOG("恢复持久化主题 %s 失败", name.c_str());
+                        continue;
+                    }
+                    std::string topic_name = meta.substr(pos);
+                    auto topic = std::make_shared<Topic>(topic_name, (OverflowPolicy)policy, retain, log);
+                    _topics.insert(topic_name, topic);
+                    INF_LOG("恢复持久化主题 %s, 下一条消息序号 %lu", topic_name.c_str(), (unsigned long)log->nextSeq());
+                }
+            }
+            // 定期调用: 清理过期的日志分段, 把日志刷到磁盘, 保存消费者提交的位置
+            void onLogTimer()
+            {
+                std::vector<TopicLog::ptr> logs;
+                _topics.forEach([&logs](const std::string &, const Topic::ptr &topic)
+                                {
+                                    if (topic->log)
+                                        logs.push_back(topic->log); });
+                for (auto &log : logs)
+                {
+                    log->expire(_log_max_bytes, _log_max_age);
+                    log->sync();
+                }
+            }
+            // 查询主题的统计信息, 主题不存在时返回 false
+            bool topicStats(const std::string &topic_name, TopicStats &stats)
+            {
+                Topic::ptr topic = _topics.find(topic_name);
+                if (!topic)
+                    return false;
+                stats.subscribers = topic->subscriberCount();
+                stats.published = topic->published;
+                stats.dropped = topic->dropped;
+                stats.log_failed = topic->log_failed;
+                return true;
+            }
             // 请求处理回调，根据 msg 的操作类型，决定执行什么操作(订阅 / 取消订阅 / 推送 ....)
             void onTopicRequest(const BaseConnection::ptr &conn, const TopicRequest::ptr &msg)
             {
                 TopicOptype topic_optype = msg->optype();
                 bool ret = true;
+                std::string missing = msg->topickey(); // 不存在的主题(批量发布时可能有多个)
                 switch (topic_optype)
                 {
                 // 主题的创建
                 case TopicOptype::TOPIC_CREATE:
-                    topicCreate(conn, msg);
+                    if (topicCreate(conn, msg) == false)
+                        return errorResponse(conn, msg, RCode::RCODE_INTERNAL_ERROR);
                     break;
                 // 主题的删除
                 case TopicOptype::TOPIC_REMOVE:
@@ -37,41 +208,66 @@ namespace TrRpc
                 case TopicOptype::TOPIC_PUBLISH:
                     ret = topicPublish(conn, msg);
                     break;
+                // 批量发布
+                case TopicOptype::TOPIC_PUBLISH_BATCH:
+                    ret = topicPublishBatch(conn, msg, missing);
+                    break;
+                // 持久化主题的消费者提交消费位置
+                case TopicOptype::TOPIC_COMMIT:
+                    ret = topicCommit(conn, msg);
+                    break;
                 default:
                     return errorResponse(conn, msg, RCode::RCODE_INVALID_OPTYPE);
                 }
+                // 不需要响应的发布: 发布者不会等待响应，失败了只记录日志
+                bool publish = topic_optype == TopicOptype::TOPIC_PUBLISH || topic_optype == TopicOptype::TOPIC_PUBLISH_BATCH;
+                if (publish && msg->ack() == false)
+                {
+                    if (!ret)
+                        ERR_LOG("发布到不存在的主题 %s, 消息被丢弃", missing.c_str());
+                    return;
+                }
                 if (!ret)
                     return errorResponse(conn, msg, RCode::RCODE_NOT_FOUND_TOPIC);
                 return topicResponse(conn, msg);
             }
+            // 二进制主题消息的发布: 不经过 Json, 按主题名称找到主题后原样推送
+            void onBinaryPublish(const BaseConnection::ptr &conn, const BinaryTopicMessage::ptr &msg)
+            {
+                Topic::ptr topic = _topics.find(msg->topickey());
+                if (topic)
+                    topic->pushMessage(msg, patternSubscribers(topic));
+                if (msg->ack() == false)
+                {
+                    if (!topic)
+                        ERR_LOG("发布到不存在的主题 %s, 消息被丢弃", msg->topickey().c_str());
+                    return;
+                }
+                if (!topic)
+                    return errorResponse(conn, msg, RCode::RCODE_NOT_FOUND_TOPIC);
+                return topicResponse(conn, msg);
+            }
             // 一个订阅者在连接断开时的处理---删除其关联的数据(如：删除对应主题中的订阅者，避免推送时推送给已取消订阅的...)
             void onShutdown(const BaseConnection::ptr &conn)
             {
-                // 如果断开连接的不是订阅者: 直接返回
-                std::vector<Topic::ptr> topics;
-                Subscriber::ptr subscriber;
+                // 移除订阅者映射信息; 如果断开连接的不是订阅者: 直接返回
+                Subscriber::ptr subscriber = _subscribers.erase(conn);
+                if (!subscriber)
+                    return;
+                if (subscriber->dropped > 0)
+                    INF_LOG("订阅者断开, 它因为发送队列满了一共丢弃了 %lu 条消息", (unsigned long)(uint64_t)subscriber->dropped);
+                for (auto &topic_name : subscriber->topicList())
                 {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    auto sub_it = _subscribers.find(conn);
-                    if (sub_it == _subscribers.end()) // 不是订阅者
-                        return;
-                    else
-                        subscriber = sub_it->second;
-                    // 移除订阅者映射信息
-                    _subscribers.erase(sub_it);
-                    for (auto topic : subscriber->topics)
+                    if (TopicName::isPattern(topic_name)) // 通配订阅: 从索引树中删除
                     {
-                        auto topic_it = _topics.find(topic); // 进一步确定主题是否有注册
-                        if (topic_it == _topics.end())
-                            continue;
-                        // 如果是这个订阅者订阅的主题，且主题有注册，则在主题里删除这个订阅者(这里先暂存，避免长时间占用锁)
-                        topics.emplace_back(topic_it->second);
+                        std::unique_lock<std::mutex> lock(_pattern_mutex);
+                        removePattern(topic_name, subscriber);
+                        continue;
                     }
-                }
-                // 从主题中移除订阅者信息
-                for (auto &topic : topics)
-                {
-                    topic->removeSubscriber(subscriber);
+                    // 如果是这个订阅者订阅的主题，且主题有注册，则在主题里删除这个订阅者
+                    Topic::ptr topic = _topics.find(topic_name);
+                    if (topic)
+                        topic->removeSubscriber(subscriber);
                 }
             }
 
@@ -93,37 +289,50 @@ namespace TrRpc
                 conn->send(msg_rsp);
             }
             // 根据主题创建请求(msg)来创建主题, conn用不到，但是为了同一接口，就留着
-            void topicCreate(const BaseConnection::ptr &conn, const TopicRequest::ptr &msg)
+            // 持久化主题的日志无法创建时返回 false(不会退化成普通主题, 否则发布者以为消息已经持久化了)
+            bool topicCreate(const BaseConnection::ptr &conn, const TopicRequest::ptr &msg)
             {
                 // 构建一个 topic 对象然后添加进去
                 std::string topic_name = msg->topickey();
-                Topic::ptr topic = std::make_shared<Topic>(topic_name);
+                size_t retain = std::min(msg->retain(), (size_t)maxRetain);
+                bool created = false;
+                // 查找和创建在分片的锁内一次完成: 同一个主题并发创建时只有一个会打开日志目录
+                Topic::ptr topic = _topics.findOrCreate(topic_name, [&]() -> Topic::ptr
+                                                        {
+                    TopicLog::ptr log;
+                    if (msg->durable())
+                    {
+                        log = createLog(topic_name, msg->overflow(), retain);
+                        if (!log)
+                            return Topic::ptr();
+                    }
+                    created = true;
+                    return std::make_shared<Topic>(topic_name, msg->overflow(), retain, log); });
+                if (!topic)
+                    return false;
+                // 已经存在(不会覆盖): 要求持久化, 但是已有的主题没有日志时不能当作创建成功
+                if (!created && msg->durable() && !topic->log)
                 {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    _topics.emplace(topic_name, topic); // 直接在 map 里构造元素(更快), 如果已经存在键值对，则什么都不做(不会覆盖)
-                    // _topics.insert(std::make_pair(topic_name, topic)); // 先构造临时 pair, 再拷贝到 map 中
+                    ERR_LOG("主题 %s 已经存在并且不是持久化主题, 不能再创建成持久化主题", topic_name.c_str());
+                    return false;
                 }
+                return true;
             }
             void topicRemove(const BaseConnection::ptr &conn, const TopicRequest::ptr &msg)
             {
                 // 既要删除主题的信息，也要移除相关订阅者中对该主题的订阅
                 std::string topic_name = msg->topickey();
-                std::vector<Subscriber::ptr> subscribers; // 临时存储有订阅了该主题的订阅者（后续删除订阅者关心的主题时，可以释放TopicManager的锁）
-                {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    auto it = _topics.find(topic_name);
-                    if (it == _topics.end())
-                        return;
-                    Topic::ptr topic = it->second;
-                    // 拷贝订阅者列表（避免后续操作持有 _mutex 锁）
-                    subscribers.assign(topic->subscribers.begin(), topic->subscribers.end());
-                    // 2. 删除这个主题的信息
-                    _topics.erase(topic_name);
-                }
-                for (auto &sub : subscribers)
+                // 1. 删除这个主题的信息
+                Topic::ptr topic = _topics.erase(topic_name);
+                if (!topic)
+                    return;
+                // 2. 订阅了该主题的订阅者不再关注它
+                for (auto &sub : topic->subscriberList())
                 {
                     sub->removeTopic(topic_name);
                 }
+                if (topic->log) // 持久化主题: 删除它的日志文件
+                    topic->log->destroy();
             }
             // 主题订阅：订阅者关注主题 + 1  and 主题下订阅者 + 1
             bool topicSubscribe(const BaseConnection::ptr &conn, const TopicRequest::ptr &msg)
@@ -131,31 +340,59 @@ namespace TrRpc
                 Topic::ptr topic;
                 Subscriber::ptr sub;
                 std::string topic_name = msg->topickey();
+                if (TopicName::isPattern(topic_name))
+                    return patternSubscribe(conn, topic_name);
+                // 1. 先判断订阅的主题是否存在，如果不存在则报错
+                topic = _topics.find(topic_name);
+                if (!topic)
                 {
-                    // 1. 先判断订阅的主题是否存在，如果不存在则报错
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    auto topic_it = _topics.find(topic_name);
-                    if (topic_it == _topics.end())
-                    {
-                        ERR_LOG("订阅了不存在的主题! ");
-                        return false;
-                    }
-                    else
-                        topic = topic_it->second;
-                    // 2. 订阅者关注的主题 + 1.  如果订阅者信息本身不存在: 创建订阅者
-                    auto sub_it = _subscribers.find(conn);
-                    if (sub_it == _subscribers.end()) // 订阅者不存在，创建新订阅者
-                    {
-                        sub = std::make_shared<Subscriber>(conn);
-                        _subscribers.emplace(conn, sub);
-                    }
-                    else // 订阅者存在
-                        sub = sub_it->second;
+                    ERR_LOG("订阅了不存在的主题! ");
+                    return false;
+                }
+                // 2. 订阅者关注的主题 + 1.  如果订阅者信息本身不存在: 创建订阅者
+                sub = subscriber(conn);
+                // 消费组订阅: 加入主题下的消费组, 之后每条消息只推送给组内的一个成员(不重放历史消息)
+                std::string group = msg->group();
+                if (group.empty() == false)
+                {
+                    sub->appendTopic(topic_name);
+                    topic->joinGroup(sub, group, msg->balance());
+                    return true;
                 }
+                // 持久化主题: 带了消费者名称但没有指定序号时, 从这个消费者上次提交的位置之后继续
+                uint64_t from_seq = msg->seq();
+                std::string consumer = msg->consumer();
+                if (from_seq == 0 && consumer.empty() == false && topic->log && topic->log->committed(consumer, from_seq))
+                    from_seq++;
                 // 订阅者关注主题 + 1
                 sub->appendTopic(topic_name);
-                // 3. 添加对应订阅者到对应主题
-                topic->appendSubscriber(sub);
+                // 3. 添加对应订阅者到对应主题(携带了序号时, 先重放保留的消息)
+                topic->appendSubscriber(sub, from_seq);
+                return true;
+            }
+            // 通配订阅: 不要求主题已经存在，之后创建的、名称匹配的主题的消息也会推送给它
+            bool patternSubscribe(const BaseConnection::ptr &conn, const std::string &pattern)
+            {
+                if (TopicName::validPattern(pattern) == false)
+                {
+                    ERR_LOG("通配订阅 %s 格式错误! ", pattern.c_str());
+                    return false;
+                }
+                Subscriber::ptr sub = subscriber(conn);
+                {
+                    std::unique_lock<std::mutex> lock(_pattern_mutex);
+                    TrieNode *node = &_trie;
+                    for (auto &level : TopicName::split(pattern))
+                    {
+                        auto &child = node->children[level];
+                        if (!child)
+                            child.reset(new TrieNode());
+                        node = child.get();
+                    }
+                    node->subscribers.insert(sub);
+                    _pattern_gen++; // 通配订阅变了，各个主题之前算好的推送对象都可能变化
+                }
+                sub->appendTopic(pattern);
                 return true;
             }
             // 主题取消订阅: 订阅者主题 -1  and  主题下订阅者 -1
@@ -164,45 +401,297 @@ namespace TrRpc
                 Topic::ptr topic;
                 Subscriber::ptr sub;
                 std::string topic_name = msg->topickey();
+                if (TopicName::isPattern(topic_name))
                 {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    auto topic_it = _topics.find(topic_name);
-                    if (topic_it == _topics.end())
-                        return;
-                    else
-                        topic = topic_it->second;
-                    auto sub_it = _subscribers.find(conn);
-                    if (sub_it == _subscribers.end())
+                    sub = _subscribers.find(conn);
+                    if (!sub)
                         return;
-                    else
-                        sub = sub_it->second;
+                    {
+                        std::unique_lock<std::mutex> lock(_pattern_mutex);
+                        removePattern(topic_name, sub);
+                    }
+                    sub->removeTopic(topic_name);
+                    return;
                 }
+                topic = _topics.find(topic_name);
+                sub = _subscribers.find(conn);
+                if (!topic || !sub)
+                    return;
+                // 只退出消费组: 订阅者可能还直接订阅了这个主题 或 在别的组中, 不修改它关注的主题
+                if (msg->group().empty() == false)
+                    return topic->leaveGroup(sub, msg->group());
                 sub->removeTopic(topic_name);
                 topic->removeSubscriber(sub);
             }
             bool topicPublish(const BaseConnection::ptr &conn, const TopicRequest::ptr &msg)
             {
-                Topic::ptr topic;
+                // 只锁主题所在的分片, 发布到不同主题的请求不会互相等待
+                Topic::ptr topic = _topics.find(msg->topickey());
+                if (!topic)
+                    return false;
+                topic->pushMessage(msg, patternSubscribers(topic));
+                return true;
+            }
+            // 提交消费位置: 只有持久化主题支持, 位置由 onLogTimer 定期落盘
+            bool topicCommit(const BaseConnection::ptr &conn, const TopicRequest::ptr &msg)
+            {
+                Topic::ptr topic = _topics.find(msg->topickey());
+                if (!topic)
+                    return false;
+                if (!topic->log || msg->consumer().empty())
                 {
-                    std::unique_lock<std::mutex> lock(_mutex);
-                    auto topic_it = _topics.find(msg->topickey());
-                    if (topic_it == _topics.end())
+                    ERR_LOG("主题 %s 不是持久化主题 或 没有携带消费者名称, 无法提交消费位置", msg->topickey().c_str());
+                    return false;
+                }
+                topic->log->commit(msg->consumer(), msg->seq());
+                return true;
+            }
+            // 创建持久化主题的日志, 没有开启持久化 或者 打开失败时返回空
+            TopicLog::ptr createLog(const std::string &topic_name, OverflowPolicy policy, size_t retain)
+            {
+                if (_log_dir.empty())
+                {
+                    ERR_LOG("服务端没有开启持久化主题, 不能创建持久化主题 %s", topic_name.c_str());
+                    return TopicLog::ptr();
+                }
+                ::mkdir(_log_dir.c_str(), 0755);
+                auto log = std::make_shared<TopicLog>(_log_dir + "/" + logDirName(topic_name), _segment_size);
+                char meta[64];
+                snprintf(meta, sizeof(meta), "%d %zu ", (int)policy, retain);
+                if (log->open() == false || log->saveMeta(meta + topic_name) == false)
+                {
+                    ERR_LOG("创建主题 %s 的日志失败", topic_name.c_str());
+                    return TopicLog::ptr();
+                }
+                return log;
+            }
+            // 主题名称转成目录名: 字母、数字、'.'、'-'、'_' 之外的字符写成 %XX
+            static std::string logDirName(const std::string &topic_name)
+            {
+                std::string result;
+                for (unsigned char c : topic_name)
+                {
+                    if (isalnum(c) || c == '-' || c == '_' || (c == '.' && !result.empty()))
+                        result.push_back(c);
+                    else
                     {
-                        return false;
+                        char buf[4];
+                        snprintf(buf, sizeof(buf), "%%%02X", c);
+                        result += buf;
                     }
-                    topic = topic_it->second;
                 }
-                topic->pushMessage(msg);
-                return true;
+                return result;
             }
-            struct Subscriber
+            // 批量发布: 按主题分组(组内保持发布顺序), 每个主题的消息合成一条批量消息推送给它的订阅者
+            // 有不存在的主题时，其它主题的消息照常推送, 但是返回 false, 不存在的主题名称(逗号分隔)放在 missing 中
+            bool topicPublishBatch(const BaseConnection::ptr &conn, const TopicRequest::ptr &msg, std::string &missing)
+            {
+                std::vector<std::string> order; // 主题第一次出现的顺序
+                std::unordered_map<std::string, std::vector<TopicMessage>> groups;
+                for (auto &item : msg->topicMsgs())
+                {
+                    auto &group = groups[item.first];
+                    if (group.empty())
+                        order.push_back(item.first);
+                    group.push_back(std::move(item));
+                }
+                bool ret = true;
+                missing.clear();
+                for (auto &topic_name : order)
+                {
+                    Topic::ptr topic = _topics.find(topic_name);
+                    if (!topic)
+                    {
+                        if (ret == false)
+                            missing += ", ";
+                        missing += topic_name;
+                        ret = false;
+                        continue;
+                    }
+                    // 推送给订阅者的每一批也不能超过网络层的限制(发布者可能不是用本客户端拆分的)
+                    for (auto &msgs : TopicRequest::splitBatch(groups[topic_name]))
+                    {
+                        auto batch = MessageFactory::create<TopicRequest>();
+                        batch->setId(UUid::uuid());
+                        batch->setMtype(MType::REQ_TOPIC);
+                        batch->setOptype(TopicOptype::TOPIC_PUBLISH_BATCH);
+                        batch->setTopicKey(topic_name);
+                        batch->setTopicMsgs(msgs);
+                        topic->pushMessage(batch, patternSubscribers(topic), msgs.size());
+                    }
+                }
+                return ret;
+            }
+            // 订阅者: 每个订阅者有一个有上限的发送队列
+            // 发布者只把(已经序列化好的)消息放进队列就返回，由连接所在的 I/O loop 取出来发送，发布者不会等待订阅者
+            // 连接的发送缓冲区积压超过 highWaterMark 时暂停取队列，等缓冲区发空(写完成回调)再继续
+            // 这样积压的消息都在有上限的队列中，队列满了按主题的策略处理
+            struct Subscriber : public std::enable_shared_from_this<Subscriber>
             {
                 using ptr = std::shared_ptr<Subscriber>;
+                using Frame = std::shared_ptr<const std::string>;
                 std::mutex _mutex;
                 BaseConnection::ptr conn;
                 std::unordered_set<std::string> topics; // 订阅的主题
-                Subscriber(BaseConnection::ptr c)
-                    : conn(c) {}
+                std::atomic<uint64_t> dropped;          // 队列满了丢弃的消息数
+                Subscriber(BaseConnection::ptr c, size_t max_queue)
+                    : conn(c), dropped(0), _max_queue(max_queue), _scheduled(false), _blocked(false), _disconnected(false)
+                {
+                    auto muduo_conn = std::dynamic_pointer_cast<MuduoConnection>(c);
+                    if (muduo_conn)
+                        _tcp = muduo_conn->tcpConnection();
+                }
+                // 把消息放进发送队列, count 是 frame 中包含的消息条数(批量消息大于 1)
+                // 返回因为队列满了丢弃的消息条数: 0 表示没有丢弃; DROP_OLDEST 时是被挤掉的那一帧的条数, 不一定等于 count
+                size_t push(const BaseMessage::ptr &msg, const Frame &frame, OverflowPolicy policy, size_t count = 1)
+                {
+                    if (!_tcp) // 不是 muduo 的连接, 直接发送(重放保留的消息时只有序列化结果，没有 msg)
+                    {
+                        if (msg)
+                            conn->send(msg);
+                        return 0;
+                    }
+                    size_t lost = 0;
+                    bool schedule = false, disconnect = false;
+                    {
+                        std::unique_lock<std::mutex> lock(_queue_mutex);
+                        if (_disconnected) // 已经因为队列满了断开, 之后的消息都丢弃
+                            return count;
+                        if (_queue.size() >= _max_queue)
+                        {
+                            if (policy == OverflowPolicy::DROP_OLDEST)
+                            {
+                                lost = _queue.front().count;
+                                _queue.pop_front();
+                                _queue.push_back(Queued{frame, count});
+                            }
+                            else if (policy == OverflowPolicy::DISCONNECT)
+                            {
+                                // 只断开一次: 清空队列, 不再发送积压的消息
+                                disconnect = _disconnected = true;
+                                lost = count;
+                                for (auto &queued : _queue)
+                                    lost += queued.count;
+                                _queue.clear();
+                                _replays.clear();
+                            }
+                            else
+                                lost = count;
+                        }
+                        else
+                            _queue.push_back(Queued{frame, count});
+                        if (_scheduled == false && _blocked == false && _queue.empty() == false)
+                            schedule = _scheduled = true;
+                    }
+                    if (schedule)
+                        _tcp->getLoop()->queueInLoop(std::bind(&Subscriber::drain, shared_from_this()));
+                    dropped += lost;
+                    if (disconnect)
+                    {
+                        ERR_LOG("订阅者消费太慢, 发送队列已满(%zu 条), 断开连接", _max_queue);
+                        _tcp->forceClose(); // 线程安全, 在连接所在的 loop 中关闭, 不等积压的数据发完
+                    }
+                    return lost;
+                }
+                // 在连接所在的 loop 线程中调用(按 loop 分组推送): 前面没有积压时直接写到连接的发送缓冲区, 不经过发送队列
+                // 有积压(队列 / 发送缓冲区超过高水位)时和 push 一样进队列, 保证顺序
+                size_t pushInLoop(const Frame &frame, OverflowPolicy policy, size_t count)
+                {
+                    {
+                        std::unique_lock<std::mutex> lock(_queue_mutex);
+                        if (_disconnected)
+                            return count;
+                        if (_queue.empty() && _blocked == false &&
+                            _tcp->outputBuffer()->readableBytes() < highWaterMark)
+                        {
+                            if (_tcp->connected())
+                                _tcp->send(frame->data(), frame->size());
+                            return 0;
+                        }
+                    }
+                    return push(BaseMessage::ptr(), frame, policy, count);
+                }
+                // 发送队列中等待发送的消息数(消费组挑选积压最少的成员)
+                size_t pending()
+                {
+                    std::unique_lock<std::mutex> lock(_queue_mutex);
+                    return _queue.size();
+                }
+                bool full()
+                {
+                    std::unique_lock<std::mutex> lock(_queue_mutex);
+                    return _queue.size() >= _max_queue;
+                }
+                // 连接所在的 I/O loop, 不是 muduo 的连接时为空
+                muduo::net::EventLoop *loop()
+                {
+                    return _tcp ? _tcp->getLoop() : nullptr;
+                }
+                // 重放读到末尾时(loop 线程中)调用, 参数是下一条要读的序号
+                using ReplayDone = std::function<void(uint64_t next)>;
+                // 读取主题保留的消息: 包含 seq 或者在它之后的第一条, 没有时返回 false, first 带出主题的下一条序号
+                using RetainedReader = std::function<bool(uint64_t seq, Frame &frame, uint64_t &first, size_t &count)>;
+                // 从持久化日志中重放 from 开始的消息: 只记录读取位置, 由 drain 在发送队列空闲时按发送缓冲区的情况一条条读出来发送
+                // 重放不占发送队列的位置, 追赶很长的历史也不会触发队列满的处理策略
+                // 读到日志末尾时调用 done, 由主题决定继续重放(期间又有新的消息) 还是 转为实时推送; 无法重放时返回 false
+                bool replay(const TopicLog::ptr &log, uint64_t from, const ReplayDone &done)
+                {
+                    return replay(Replay{log, RetainedReader(), from, done});
+                }
+                // 同上, 从主题保留的消息中重放(只记录读取位置, 保留的消息再多也不会挤满发送队列)
+                bool replay(const RetainedReader &reader, uint64_t from, const ReplayDone &done)
+                {
+                    return replay(Replay{TopicLog::ptr(), reader, from, done});
+                }
+                // 在连接所在的 loop 线程中执行: 取出队列中的消息发送，直到队列为空 或 发送缓冲区积压太多
+                void drain()
+                {
+                    while (true)
+                    {
+                        Frame frame;
+                        Replay replay;
+                        {
+                            std::unique_lock<std::mutex> lock(_queue_mutex);
+                            if (_queue.empty() && _replays.empty())
+                            {
+                                _scheduled = false;
+                                return;
+                            }
+                            if (_tcp->outputBuffer()->readableBytes() >= highWaterMark)
+                            {
+                                // 等发送缓冲区发空以后再继续, 期间新来的消息只进队列
+                                _scheduled = false;
+                                if (_blocked == false)
+                                {
+                                    _blocked = true;
+                                    std::weak_ptr<Subscriber> weak = shared_from_this();
+                                    _tcp->setWriteCompleteCallback([weak](const muduo::net::TcpConnectionPtr &)
+                                                                   {
+                                                                       auto self = weak.lock();
+                                                                       if (self)
+                                                                           self->resume(); });
+                                }
+                                return;
+                            }
+                            // 先发送队列中的实时消息(重放中的主题的新消息不进队列, 不用等重放完)
+                            if (_queue.empty() == false)
+                            {
+                                frame = _queue.front().frame;
+                                _queue.pop_front();
+                            }
+                            else
+                                replay = _replays.front();
+                        }
+                        if (_tcp->connected() == false)
+                            return;
+                        if (replay.done)
+                        {
+                            sendReplay(replay);
+                            continue;
+                        }
+                        _tcp->send(frame->data(), frame->size());
+                    }
+                }
                 void appendTopic(const std::string &topic_name)
                 {
                     std::unique_lock<std::mutex> lock(_mutex);
@@ -213,42 +702,518 @@ namespace TrRpc
                     std::unique_lock<std::mutex> lock(_mutex);
                     topics.erase(topic_name);
                 }
+                std::vector<std::string> topicList()
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    return std::vector<std::string>(topics.begin(), topics.end());
+                }
+
+            private:
+                struct Queued
+                {
+                    Frame frame;
+                    size_t count; // 帧中包含的消息条数
+                };
+                struct Replay
+                {
+                    TopicLog::ptr log;       // 从日志中读取, 为空时从保留的消息中读取
+                    RetainedReader retained;
+                    uint64_t next; // 下一条要发送的序号
+                    ReplayDone done;
+                };
+                bool replay(const Replay &replay)
+                {
+                    if (!_tcp)
+                        return false;
+                    bool schedule = false;
+                    {
+                        std::unique_lock<std::mutex> lock(_queue_mutex);
+                        if (_disconnected)
+                            return false;
+                        _replays.push_back(replay);
+                        if (_scheduled == false && _blocked == false)
+                            schedule = _scheduled = true;
+                    }
+                    if (schedule)
+                        _tcp->getLoop()->queueInLoop(std::bind(&Subscriber::drain, shared_from_this()));
+                    return true;
+                }
+                // 发送 replay.next 所在的记录(日志直接从映射内存中发送, 保留的消息复用序列化结果), 然后移动读取位置(loop 线程)
+                void sendReplay(const Replay &replay)
+                {
+                    LogSegment::ptr segment;
+                    Frame frame;
+                    const char *data = nullptr;
+                    size_t len = 0, count = 0;
+                    uint64_t first = 0, next = 0;
+                    bool found = false;
+                    if (replay.log)
+                        found = replay.log->read(replay.next, segment, data, len, first, count);
+                    else if (replay.retained(replay.next, frame, first, count))
+                    {
+                        found = true;
+                        data = frame->data();
+                        len = frame->size();
+                    }
+                    if (found)
+                    {
+                        _tcp->send(data, len);
+                        next = first + count;
+                    }
+                    else if (first > replay.next) // 这部分已经被清理了, 从还保留着的最早的消息继续
+                        next = first;
+                    ReplayDone done;
+                    {
+                        std::unique_lock<std::mutex> lock(_queue_mutex);
+                        if (_replays.empty()) // 队列满了断开连接时清空了
+                            return;
+                        if (next > 0)
+                        {
+                            _replays.front().next = next;
+                            return;
+                        }
+                        done = std::move(_replays.front().done);
+                        _replays.pop_front();
+                    }
+                    done(replay.next); // 读到了末尾
+                }
+                // 发送缓冲区发空了(loop 线程): 取消写完成回调, 继续发送队列中的消息
+                void resume()
+                {
+                    _tcp->setWriteCompleteCallback(muduo::net::WriteCompleteCallback());
+                    {
+                        std::unique_lock<std::mutex> lock(_queue_mutex);
+                        _blocked = false;
+                        _scheduled = true;
+                    }
+                    drain();
+                }
+                static constexpr size_t highWaterMark = 1 << 20; // 发送缓冲区积压超过 1MB 时暂停
+                size_t _max_queue;
+                muduo::net::TcpConnectionPtr _tcp;
+                std::mutex _queue_mutex;
+                std::deque<Queued> _queue; // 等待发送的消息(多个订阅者共享同一份序列化结果)
+                std::deque<Replay> _replays; // 正在进行的重放(持久化日志 或 保留的消息), _queue 为空时发送
+                bool _scheduled;          // 已经安排了 drain 还没执行完
+                bool _blocked;            // 发送缓冲区积压太多，在等写完成回调
+                bool _disconnected;       // 队列满了(DISCONNECT 策略)已经断开连接
             };
 
-            struct Topic
+            struct Topic : public std::enable_shared_from_this<Topic>
             {
                 using ptr = std::shared_ptr<Topic>;
                 std::mutex _mutex;
                 std::string topic_name;
+                OverflowPolicy policy;                           // 订阅者发送队列满了时的处理策略
                 std::unordered_set<Subscriber::ptr> subscribers; // 当前主题的订阅者
-                Topic(const std::string &name) : topic_name(name) {}
+                std::atomic<uint64_t> published;
+                std::atomic<uint64_t> dropped;
+                std::atomic<uint64_t> log_failed;
+                TopicLog::ptr log; // 持久化主题的日志, 普通主题为空
+                // 通配订阅中匹配这个主题的订阅者(缓存, 由 TopicManager 在通配订阅的版本号变化后重新计算)
+                std::shared_ptr<const std::vector<Subscriber::ptr>> fanout;
+                uint64_t fanout_gen = 0;
+                Topic(const std::string &name, OverflowPolicy p, size_t retain_count, const TopicLog::ptr &topic_log = TopicLog::ptr())
+                    : topic_name(name), policy(p), published(0), dropped(0), log_failed(0), log(topic_log), retain(retain_count),
+                      next_seq(topic_log ? topic_log->nextSeq() : 1) {}
+                size_t subscriberCount()
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    return subscribers.size() + replaying.size();
+                }
+                std::vector<Subscriber::ptr> subscriberList()
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    std::vector<Subscriber::ptr> result(subscribers.begin(), subscribers.end());
+                    result.insert(result.end(), replaying.begin(), replaying.end());
+                    return result;
+                }
                 // 新增订阅的时候调用
-                void appendSubscriber(const Subscriber::ptr &subscriber)
+                // from_seq 不为 0 时, 先重放序号不小于 from_seq 的消息: 普通主题重放保留的消息(直接复用保存的序列化结果),
+                // 持久化主题从日志重放, 不受保留条数的限制; 重放只记录读取位置, 不占订阅者发送队列的位置
+                // 追赶期间订阅者不在 subscribers 中, 新消息由重放读出来; 读到末尾时(加锁)确认没有新消息才加入 subscribers,
+                // 之后的消息实时推送, 重放的消息和之后的新消息之间不会有遗漏或重复; 正在追赶时再次订阅不重新开始
+                // (批量消息整条重放, 订阅者可能收到几条序号小于 from_seq 的消息; 追赶期间被挤出保留队列的消息会跳过)
+                void appendSubscriber(const Subscriber::ptr &subscriber, uint64_t from_seq = 0)
                 {
                     std::unique_lock<std::mutex> lock(_mutex);
+                    if (replaying.count(subscriber) > 0)
+                        return;
+                    plan.reset();
+                    if (from_seq > 0 && (log || retain > 0))
+                    {
+                        subscribers.erase(subscriber);
+                        replaying.insert(subscriber);
+                        return catchUp(subscriber, from_seq);
+                    }
                     subscribers.insert(subscriber);
                 }
-                // 取消订阅 或者 订阅者连接断开 的时候调用
+                // 取消订阅 或者 订阅者连接断开 的时候调用(同时退出这个主题下的所有消费组)
                 void removeSubscriber(const Subscriber::ptr &subscriber)
                 {
                     std::unique_lock<std::mutex> lock(_mutex);
                     subscribers.erase(subscriber);
+                    replaying.erase(subscriber);
+                    plan.reset();
+                    for (auto it = groups.begin(); it != groups.end();)
+                    {
+                        removeMember(it->second, subscriber);
+                        if (it->second.members.empty())
+                            it = groups.erase(it);
+                        else
+                            ++it;
+                    }
+                }
+                // 加入消费组, 组不存在时以 balance 策略创建
+                void joinGroup(const Subscriber::ptr &subscriber, const std::string &group, GroupBalance balance)
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    auto it = groups.find(group);
+                    if (it == groups.end())
+                    {
+                        ConsumerGroup consumer_group;
+                        consumer_group.balance = balance;
+                        consumer_group.next = 0;
+                        it = groups.emplace(group, consumer_group).first;
+                    }
+                    auto &members = it->second.members;
+                    if (std::find(members.begin(), members.end(), subscriber) == members.end())
+                        members.push_back(subscriber);
+                }
+                void leaveGroup(const Subscriber::ptr &subscriber, const std::string &group)
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    auto it = groups.find(group);
+                    if (it == groups.end())
+                        return;
+                    removeMember(it->second, subscriber);
+                    if (it->second.members.empty())
+                        groups.erase(it);
                 }
                 // 收到消息发布请求的时候调用
-                void pushMessage(const BaseMessage::ptr &msg)
+                // patterns 是通配订阅匹配到的订阅者, 同时直接订阅了这个主题的只推送一次
+                // 消息带上序号后只序列化一次, 放进保留队列 和 各个订阅者的发送队列
+                // 订阅者按所在的 I/O loop 分组, 每个 loop 只投递一个任务, 由 loop 线程把同一份帧交给本 loop 的订阅者
+                // 发布线程在锁内的开销只与 loop 的个数有关(与订阅者个数无关), 各个 loop 并行推送
+                // 投递在锁内完成, 同一个 loop 的任务按投递顺序执行: 保证每个订阅者收到的消息序号是递增的
+                // count: msg 中包含的消息条数(批量发布时大于 1); 一条批量消息在订阅者的队列中只占一个位置
+                void pushMessage(const TopicRequest::ptr &msg, const std::shared_ptr<const std::vector<Subscriber::ptr>> &patterns, size_t count = 1)
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    msg->setSeq(next_seq);
+                    pushLocked(msg, patterns, count);
+                }
+                // 二进制消息: 只改写头部的序号, 内容原样转发
+                void pushMessage(const BinaryTopicMessage::ptr &msg, const std::shared_ptr<const std::vector<Subscriber::ptr>> &patterns)
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    msg->setSeq(next_seq);
+                    pushLocked(msg, patterns, 1);
+                }
+
+                // 订阅者的重放读到了末尾(loop 线程)
+                void replayDone(const Subscriber::ptr &subscriber, uint64_t next)
                 {
                     std::unique_lock<std::mutex> lock(_mutex);
-                    for (auto sub : subscribers)
+                    catchUp(subscriber, next);
+                }
+
+            private:
+                // 调用者已加锁: 从 next 开始重放日志 或 保留的消息; 已经读到末尾(或者无法重放)时转为实时推送
+                void catchUp(const Subscriber::ptr &subscriber, uint64_t next)
+                {
+                    if (replaying.count(subscriber) == 0) // 追赶期间取消了订阅
+                        return;
+                    if (next < (log ? log->nextSeq() : next_seq))
+                    {
+                        std::weak_ptr<Topic> weak = shared_from_this();
+                        std::weak_ptr<Subscriber> weak_sub = subscriber; // 重放记录在订阅者中, 不能持有订阅者自己
+                        auto done = [weak, weak_sub](uint64_t seq)
+                        {
+                            auto self = weak.lock();
+                            auto sub = weak_sub.lock();
+                            if (self && sub)
+                                self->replayDone(sub, seq);
+                        };
+                        if (log ? subscriber->replay(log, next, done) : subscriber->replay(retainedReader(), next, done))
+                            return;
+                    }
+                    replaying.erase(subscriber);
+                    subscribers.insert(subscriber);
+                    plan.reset();
+                }
+                // 按序号读取保留的消息(在订阅者的 loop 线程中调用, 读取时加锁)
+                Subscriber::RetainedReader retainedReader()
+                {
+                    std::weak_ptr<Topic> weak = shared_from_this();
+                    return [weak](uint64_t seq, Subscriber::Frame &frame, uint64_t &first, size_t &count)
+                    {
+                        auto self = weak.lock();
+                        if (!self)
+                        {
+                            first = seq;
+                            return false;
+                        }
+                        std::unique_lock<std::mutex> lock(self->_mutex);
+                        // 保留的消息按序号排列: 第一条末尾序号大于 seq 的
+                        auto it = std::upper_bound(self->ring.begin(), self->ring.end(), seq,
+                                                   [](uint64_t value, const Retained &r)
+                                                   { return value < r.seq + r.count; });
+                        if (it == self->ring.end())
+                        {
+                            first = self->next_seq;
+                            return false;
+                        }
+                        frame = it->frame;
+                        first = it->seq;
+                        count = it->count;
+                        return true;
+                    };
+                }
+                // 调用者已加锁, 并且已经给 msg 设置了序号 next_seq
+                void pushLocked(const BaseMessage::ptr &msg, const std::shared_ptr<const std::vector<Subscriber::ptr>> &patterns, size_t count)
+                {
+                    uint64_t seq = next_seq;
+                    next_seq += count;
+                    published += count;
+                    if (subscribers.empty() && patterns->empty() && groups.empty() && retain == 0 && !log)
+                        return;
+                    Subscriber::Frame frame = std::make_shared<const std::string>(LVProtocolFactory::create()->serialize(msg));
+                    if (log && log->append(seq, count, *frame) == false)
+                        ERR_LOG("主题 %s 的消息 %lu 写入日志失败(累计 %lu 次), 这条消息不能重放", topic_name.c_str(),
+                                (unsigned long)seq, (unsigned long)++log_failed);
+                    if (retain > 0)
+                    {
+                        ring.push_back(Retained{seq, count, frame});
+                        retained += count;
+                        while (retained - ring.front().count >= retain) // 去掉最旧的之后仍然保留了至少 retain 条
+                        {
+                            retained -= ring.front().count;
+                            ring.pop_front();
+                        }
+                    }
+                    // 每个消费组只推送给一个成员(经过发送队列, 和这个成员的其它消息保持顺序)
+                    for (auto &group : groups)
+                    {
+                        dropped += pickMember(group.second)->push(msg, frame, policy, count);
+                    }
+                    if (!plan || plan->patterns != patterns)
+                        plan = buildPlan(patterns);
+                    for (auto &sub : plan->local)
                     {
-                        sub->conn->send(msg);
+                        dropped += sub->push(msg, frame, policy, count);
                     }
+                    // 不能用 runInLoop: 发布线程正好是某个 loop 时会立即执行, 跑到这个 loop 中还没执行的前一条消息前面
+                    auto self = shared_from_this();
+                    auto current = plan;
+                    for (size_t i = 0; i < current->groups.size(); i++)
+                    {
+                        current->groups[i].loop->queueInLoop([self, current, i, frame, count]()
+                                                             { self->pushInLoop(current->groups[i].subscribers, frame, count); });
+                    }
+                }
+                // 消费组: 同一组的订阅者合起来每条消息只收到一次
+                struct ConsumerGroup
+                {
+                    GroupBalance balance;
+                    std::vector<Subscriber::ptr> members;
+                    size_t next; // 轮询的下一个位置
+                };
+                // 挑选接收消息的成员(调用者已加锁): 轮询时跳过发送队列已满的成员; 积压最少时从轮询位置开始比较, 积压相同的轮流接收
+                const Subscriber::ptr &pickMember(ConsumerGroup &group)
+                {
+                    auto &members = group.members;
+                    size_t n = members.size(), start = group.next % n, chosen = start;
+                    if (group.balance == GroupBalance::LEAST_PENDING)
+                    {
+                        size_t least = SIZE_MAX;
+                        for (size_t i = 0; i < n && least > 0; i++)
+                        {
+                            size_t k = (start + i) % n, pending = members[k]->pending();
+                            if (pending < least)
+                            {
+                                least = pending;
+                                chosen = k;
+                            }
+                        }
+                    }
+                    else
+                    {
+                        for (size_t i = 0; i < n; i++)
+                        {
+                            size_t k = (start + i) % n;
+                            if (members[k]->full() == false)
+                            {
+                                chosen = k;
+                                break;
+                            }
+                        }
+                    }
+                    group.next = chosen + 1;
+                    return members[chosen];
+                }
+                static void removeMember(ConsumerGroup &group, const Subscriber::ptr &subscriber)
+                {
+                    auto &members = group.members;
+                    auto it = std::find(members.begin(), members.end(), subscriber);
+                    if (it != members.end())
+                        members.erase(it);
                 }
+                std::unordered_map<std::string, ConsumerGroup> groups; // 消费组名称 -> 消费组
+                // 同一个 I/O loop 上的订阅者
+                struct LoopGroup
+                {
+                    muduo::net::EventLoop *loop;
+                    std::vector<Subscriber::ptr> subscribers;
+                };
+                // 推送计划: 直接订阅者 + 通配订阅者(去重) 按 loop 分组; 订阅者 或 通配订阅变化后的第一次发布时重新生成
+                struct FanoutPlan
+                {
+                    std::shared_ptr<const std::vector<Subscriber::ptr>> patterns; // 生成计划时的通配订阅者
+                    std::vector<Subscriber::ptr> local;                           // 不是 muduo 的连接, 在发布线程中直接推送
+                    std::vector<LoopGroup> groups;
+                };
+                // 调用者已加锁
+                std::shared_ptr<const FanoutPlan> buildPlan(const std::shared_ptr<const std::vector<Subscriber::ptr>> &patterns)
+                {
+                    auto result = std::make_shared<FanoutPlan>();
+                    result->patterns = patterns;
+                    std::unordered_map<muduo::net::EventLoop *, size_t> index; // loop -> groups 中的下标
+                    auto add = [&result, &index](const Subscriber::ptr &sub)
+                    {
+                        muduo::net::EventLoop *loop = sub->loop();
+                        if (loop == nullptr)
+                            return result->local.push_back(sub);
+                        auto it = index.find(loop);
+                        if (it == index.end())
+                        {
+                            it = index.emplace(loop, result->groups.size()).first;
+                            result->groups.push_back(LoopGroup{loop, std::vector<Subscriber::ptr>()});
+                        }
+                        result->groups[it->second].subscribers.push_back(sub);
+                    };
+                    for (auto &sub : subscribers)
+                        add(sub);
+                    for (auto &sub : *patterns)
+                    {
+                        if (subscribers.count(sub) == 0 && replaying.count(sub) == 0)
+                            add(sub);
+                    }
+                    return result;
+                }
+                // 在 loop 线程中执行: 把帧交给这个 loop 上的订阅者
+                void pushInLoop(const std::vector<Subscriber::ptr> &subs, const Subscriber::Frame &frame, size_t count)
+                {
+                    for (auto &sub : subs)
+                    {
+                        dropped += sub->pushInLoop(frame, policy, count);
+                    }
+                }
+                // 保留的一条消息(或一条批量消息): 序列化好的完整帧, 重放时直接放进订阅者的发送队列
+                struct Retained
+                {
+                    uint64_t seq;  // (第一条)消息的序号
+                    size_t count;  // 包含的消息条数
+                    Subscriber::Frame frame;
+                };
+                size_t retain;              // 最多保留多少条消息
+                size_t retained = 0;        // 当前保留的消息条数
+                uint64_t next_seq;          // 下一条消息的序号(持久化主题接着日志中的继续)
+                std::deque<Retained> ring;  // 保留的最近的消息, 旧的在前
+                std::unordered_set<Subscriber::ptr> replaying; // 正在从日志追赶的订阅者, 追上以后移到 subscribers
+                std::shared_ptr<const FanoutPlan> plan; // 为空表示需要重新生成
+            };
+            // 通配订阅的索引树: 每个节点是主题名称的一层('*' 和 '#' 也作为普通的一层存储)
+            // 发布时沿着具体主题名称的各层往下走，开销只与名称的层数有关，与通配订阅的数量无关
+            struct TrieNode
+            {
+                std::unordered_map<std::string, std::unique_ptr<TrieNode>> children;
+                std::unordered_set<Subscriber::ptr> subscribers; // 订阅模式在这一层结束的订阅者
             };
+            // 连接对应的订阅者, 不存在时创建
+            Subscriber::ptr subscriber(const BaseConnection::ptr &conn)
+            {
+                size_t max_queue = _max_queue;
+                return _subscribers.findOrCreate(conn, [&conn, max_queue]()
+                                                 { return std::make_shared<Subscriber>(conn, max_queue); });
+            }
+            // 通配订阅中匹配这个主题的订阅者
+            // 结果缓存在主题中，通配订阅没有变化(版本号不变)时，发布不需要查索引树, 也不需要加通配订阅的锁
+            std::shared_ptr<const std::vector<Subscriber::ptr>> patternSubscribers(const Topic::ptr &topic)
+            {
+                uint64_t gen = _pattern_gen;
+                {
+                    std::unique_lock<std::mutex> lock(topic->_mutex);
+                    if (topic->fanout && topic->fanout_gen == gen)
+                        return topic->fanout;
+                }
+                std::unordered_set<Subscriber::ptr> matched;
+                {
+                    std::unique_lock<std::mutex> lock(_pattern_mutex);
+                    gen = _pattern_gen;
+                    matchPattern(&_trie, TopicName::split(topic->topic_name), 0, matched);
+                }
+                auto result = std::make_shared<const std::vector<Subscriber::ptr>>(matched.begin(), matched.end());
+                std::unique_lock<std::mutex> lock(topic->_mutex);
+                topic->fanout = result;
+                topic->fanout_gen = gen;
+                return result;
+            }
+            // 在索引树中查找匹配 levels[i...] 的订阅: 同时沿着 具体名称 和 '*' 往下走, 遇到 '#' 直接匹配剩下的所有层
+            void matchPattern(TrieNode *node, const std::vector<std::string> &levels, size_t i, std::unordered_set<Subscriber::ptr> &matched)
+            {
+                auto multi = node->children.find("#");
+                if (multi != node->children.end())
+                    matched.insert(multi->second->subscribers.begin(), multi->second->subscribers.end());
+                if (i == levels.size())
+                {
+                    matched.insert(node->subscribers.begin(), node->subscribers.end());
+                    return;
+                }
+                auto exact = node->children.find(levels[i]);
+                if (exact != node->children.end())
+                    matchPattern(exact->second.get(), levels, i + 1, matched);
+                auto single = node->children.find("*");
+                if (single != node->children.end())
+                    matchPattern(single->second.get(), levels, i + 1, matched);
+            }
+            // 从索引树中删除一个通配订阅, 并回收空出来的节点(调用者已加 _pattern_mutex)
+            void removePattern(const std::string &pattern, const Subscriber::ptr &sub)
+            {
+                auto levels = TopicName::split(pattern);
+                std::vector<std::pair<TrieNode *, std::string>> path; // 经过的节点 和 往下走的那一层
+                TrieNode *node = &_trie;
+                for (auto &level : levels)
+                {
+                    auto it = node->children.find(level);
+                    if (it == node->children.end())
+                        return;
+                    path.push_back(std::make_pair(node, level));
+                    node = it->second.get();
+                }
+                node->subscribers.erase(sub);
+                for (auto it = path.rbegin(); it != path.rend(); ++it)
+                {
+                    TrieNode *child = it->first->children[it->second].get();
+                    if (!child->subscribers.empty() || !child->children.empty())
+                        break;
+                    it->first->children.erase(it->second);
+                }
+                _pattern_gen++;
+            }
 
         private:
-            std::mutex _mutex;
-            std::unordered_map<std::string, Topic::ptr> _topics;                   // 管理主题
-            std::unordered_map<BaseConnection::ptr, Subscriber::ptr> _subscribers; // 管理订阅者(每一个都是独立的订阅者)
+            static constexpr size_t maxRetain = 1 << 20; // 每个主题最多保留的消息条数
+            size_t _max_queue = 4096;
+            std::string _log_dir; // 为空表示不支持持久化主题
+            size_t _segment_size = 64 << 20;
+            size_t _log_max_bytes = 0;
+            int _log_max_age = 0;
+            ShardedMap<std::string, Topic::ptr> _topics;                   // 管理主题
+            ShardedMap<BaseConnection::ptr, Subscriber::ptr> _subscribers; // 管理订阅者(每一个都是独立的订阅者)
+            std::mutex _pattern_mutex;                                     // 保护通配订阅的索引树
+            TrieNode _trie;                                                // 通配订阅
+            std::atomic<uint64_t> _pattern_gen{1};                         // 通配订阅的版本号: 每次增删通配订阅加 1
         };
     }
 }
@@ -0,0 +1,412 @@
+#pragma once
+#include "../common/mmap.hpp"
+#include <dirent.h>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+namespace TrRpc
+{
+    namespace server
+    {
+        // 主题日志的一个分段: 数据文件(.log) + 索引文件(.idx), 都是预先分配好大小的内存映射文件
+        // 数据文件: 一条接一条的记录 |--len(4)--|--count(4)--|--time(8)--|--frame--|, len 为 0 表示后面没有数据了
+        // 一条记录是一次推送给订阅者的完整帧(批量发布时一条记录包含 count 条消息), 读取时直接发送映射内存中的 frame
+        // 索引文件: 每条记录一项 {记录的序号 - 分段起始序号, 记录在数据文件中的偏移 + 1}, 按序号二分查找
+        class LogSegment
+        {
+        public:
+            using ptr = std::shared_ptr<LogSegment>;
+            // 打开(不存在则创建)分段, 恢复已经写入的记录
+            bool open(const std::string &dir, uint64_t base, size_t capacity)
+            {
+                _base = base;
+                _path = dir + "/" + name(base);
+                // 已经存在的分段按它原来的大小打开(分段大小的配置可能改过)
+                size_t log_size = std::max(capacity, fileSize(_path + ".log"));
+                size_t idx_size = std::max(indexSize(capacity), fileSize(_path + ".idx"));
+                if (_log.openWrite(_path + ".log", log_size) == false || _idx.openWrite(_path + ".idx", idx_size) == false)
+                    return false;
+                recover();
+                return true;
+            }
+            // 追加一条记录(序号必须是 nextSeq()), 分段写满了返回 false
+            bool append(uint64_t seq, size_t count, const std::string &frame, int64_t now)
+            {
+                size_t need = recordHeader + frame.size();
+                if (seq != nextSeq() || _write_pos + need > _log.size() || (_records + 1) * sizeof(Entry) > _idx.size())
+                    return false;
+                char *rec = _log.data() + _write_pos;
+                uint32_t len = frame.size(), cnt = count;
+                memcpy(rec + recordHeader, frame.data(), frame.size());
+                memcpy(rec + 4, &cnt, 4);
+                memcpy(rec + 8, &now, 8);
+                memcpy(rec, &len, 4); // 长度最后写: 长度不为 0 的记录一定是完整的
+                Entry entry{(uint32_t)(seq - _base), (uint32_t)(_write_pos + 1)};
+                memcpy(_idx.data() + _records * sizeof(Entry), &entry, sizeof(Entry));
+                _records++;
+                _write_pos += need;
+                _count += count;
+                _last_time = now;
+                return true;
+            }
+            // 找到包含 seq 的记录: data / len 指向映射内存中的帧(分段对象存在期间一直有效)
+            bool read(uint64_t seq, const char *&data, size_t &len, uint64_t &first, size_t &count)
+            {
+                if (seq < _base || seq >= nextSeq())
+                    return false;
+                const Entry *entries = reinterpret_cast<const Entry *>(_idx.data());
+                uint32_t offset = seq - _base;
+                // 最后一个起始序号不大于 seq 的记录
+                const Entry *it = std::upper_bound(entries, entries + _records, offset,
+                                                   [](uint32_t value, const Entry &e)
+                                                   { return value < e.seq_offset; });
+                if (it == entries)
+                    return false;
+                --it;
+                const char *rec = _log.data() + it->pos - 1;
+                uint32_t rec_len = 0, rec_count = 0;
+                memcpy(&rec_len, rec, 4);
+                memcpy(&rec_count, rec + 4, 4);
+                first = _base + it->seq_offset;
+                count = rec_count;
+                data = rec + recordHeader;
+                len = rec_len;
+                return true;
+            }
+            void sync()
+            {
+                _log.sync();
+                _idx.sync();
+            }
+            // 删除分段的文件(已经映射的内存在对象析构前仍然可以读)
+            void remove()
+            {
+                ::unlink((_path + ".log").c_str());
+                ::unlink((_path + ".idx").c_str());
+            }
+            uint64_t base() { return _base; }
+            uint64_t nextSeq() { return _base + _count; }
+            size_t bytes() { return _write_pos; }
+            // 分段文件占用的磁盘空间(创建时预先分配, 与写了多少无关)
+            size_t allocated() { return _log.size() + _idx.size(); }
+            // 一条帧写成记录以后的大小: 超过分段大小的帧任何分段都放不下
+            static size_t recordSize(size_t frame_size) { return recordHeader + frame_size; }
+            int64_t lastTime() { return _last_time; }
+            static std::string name(uint64_t base)
+            {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%020llu", (unsigned long long)base);
+                return buf;
+            }
+
+        private:
+            struct Entry
+            {
+                uint32_t seq_offset;
+                uint32_t pos; // 偏移 + 1, 0 表示没有这一项
+            };
+            // 先按索引恢复, 再从最后一条索引的记录往后扫描(写完数据还没写索引时崩溃, 补上索引)
+            void recover()
+            {
+                _records = 0;
+                _write_pos = 0;
+                _count = 0;
+                _last_time = 0;
+                size_t max_entries = _idx.size() / sizeof(Entry);
+                while (_records < max_entries)
+                {
+                    Entry entry;
+                    memcpy(&entry, _idx.data() + _records * sizeof(Entry), sizeof(Entry));
+                    if (entry.pos == 0 || entry.pos - 1 != _write_pos || entry.seq_offset != _count || !readRecord())
+                        break;
+                    _records++;
+                }
+                while ((_records + 1) * sizeof(Entry) <= _idx.size())
+                {
+                    size_t pos = _write_pos;
+                    uint64_t seq_offset = _count;
+                    if (readRecord() == false)
+                        break;
+                    Entry entry{(uint32_t)seq_offset, (uint32_t)(pos + 1)};
+                    memcpy(_idx.data() + _records * sizeof(Entry), &entry, sizeof(Entry));
+                    _records++;
+                }
+                // 清掉后面残留的索引项(上次崩溃时写了一半的记录)
+                size_t tail = _records * sizeof(Entry);
+                memset(_idx.data() + tail, 0, std::min(_idx.size() - tail, sizeof(Entry)));
+            }
+            // 读取 _write_pos 处的记录头, 记录完整时移动到下一条
+            bool readRecord()
+            {
+                if (_write_pos + recordHeader > _log.size())
+                    return false;
+                const char *rec = _log.data() + _write_pos;
+                uint32_t len = 0, count = 0;
+                memcpy(&len, rec, 4);
+                memcpy(&count, rec + 4, 4);
+                if (len == 0 || count == 0 || _write_pos + recordHeader + len > _log.size())
+                    return false;
+                memcpy(&_last_time, rec + 8, 8);
+                _write_pos += recordHeader + len;
+                _count += count;
+                return true;
+            }
+            static size_t indexSize(size_t capacity)
+            {
+                return std::max((size_t)4096, capacity / 8); // 平均每条记录不小于 64 字节
+            }
+            static size_t fileSize(const std::string &path)
+            {
+                struct stat st;
+                if (::stat(path.c_str(), &st) < 0)
+                    return 0;
+                return st.st_size;
+            }
+
+        private:
+            static constexpr size_t recordHeader = 16;
+            uint64_t _base = 1;
+            std::string _path;
+            MmapFile _log;
+            MmapFile _idx;
+            size_t _records = 0;   // 记录条数
+            size_t _write_pos = 0; // 数据文件的写入位置
+            uint64_t _count = 0;   // 消息条数
+            int64_t _last_time = 0; // 最后一条记录的写入时间(ms)
+        };
+
+        // 一个主题的持久化日志: 按序号顺序排列的多个分段, 写满一个分段就新建下一个
+        // 按总大小 / 时间清理最旧的分段; 同时保存各个消费者提交的消费位置(offsets 文件)
+        class TopicLog
+        {
+        public:
+            using ptr = std::shared_ptr<TopicLog>;
+            TopicLog(const std::string &dir, size_t segment_size)
+                : _dir(dir), _segment_size(segment_size), _offsets_dirty(false) {}
+            // 打开日志目录, 恢复已有的分段和消费位置
+            bool open()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (::mkdir(_dir.c_str(), 0755) < 0 && errno != EEXIST)
+                {
+                    ERR_LOG("创建主题日志目录 %s 失败: %s", _dir.c_str(), strerror(errno));
+                    return false;
+                }
+                std::vector<uint64_t> bases;
+                DIR *dir = ::opendir(_dir.c_str());
+                if (dir == nullptr)
+                    return false;
+                while (struct dirent *ent = ::readdir(dir))
+                {
+                    std::string file = ent->d_name;
+                    if (file.size() == 24 && file.compare(20, 4, ".log") == 0)
+                        bases.push_back(std::stoull(file.substr(0, 20)));
+                }
+                ::closedir(dir);
+                std::sort(bases.begin(), bases.end());
+                for (auto base : bases)
+                {
+                    auto segment = std::make_shared<LogSegment>();
+                    if (segment->open(_dir, base, _segment_size) == false)
+                        return false;
+                    _segments.push_back(segment);
+                }
+                if (_segments.empty() && roll(1) == false)
+                    return false;
+                loadOffsets();
+                return true;
+            }
+            uint64_t nextSeq()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                return _segments.back()->nextSeq();
+            }
+            uint64_t firstSeq()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                return _segments.front()->base();
+            }
+            // 追加一条记录(序号为 seq 的 count 条消息)
+            bool append(uint64_t seq, size_t count, const std::string &frame)
+            {
+                int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  std::chrono::system_clock::now().time_since_epoch())
+                                  .count();
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_segments.back()->append(seq, count, frame, now))
+                    return true;
+                // 新分段也放不下: 不要为它新建分段(否则每次写入失败都会创建并分配一个新文件)
+                if (LogSegment::recordSize(frame.size()) > _segment_size)
+                {
+                    ERR_LOG("主题日志 %s 写入失败: 消息 %zu 字节, 超过分段大小 %zu", _dir.c_str(), frame.size(), _segment_size);
+                    return false;
+                }
+                if (roll(seq) == false || _segments.back()->append(seq, count, frame, now) == false)
+                {
+                    ERR_LOG("主题日志 %s 写入失败(消息 %zu 字节)", _dir.c_str(), frame.size());
+                    return false;
+                }
+                return true;
+            }
+            // 读取包含 seq 的记录, 返回的 segment 保证 data 在使用期间有效
+            // seq 已经被清理时返回 false, first 带出当前最早的序号
+            bool read(uint64_t seq, LogSegment::ptr &segment, const char *&data, size_t &len, uint64_t &first, size_t &count)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                // 最后一个起始序号不大于 seq 的分段
+                auto it = std::upper_bound(_segments.begin(), _segments.end(), seq,
+                                           [](uint64_t value, const LogSegment::ptr &s)
+                                           { return value < s->base(); });
+                if (it == _segments.begin())
+                {
+                    first = _segments.front()->base();
+                    return false;
+                }
+                segment = *(it - 1);
+                if (segment->read(seq, data, len, first, count))
+                    return true;
+                // 写入失败时会跳过几个序号另起一个分段: 从下一个分段继续, 没有下一个分段时 first 是日志末尾
+                first = it == _segments.end() ? _segments.back()->nextSeq() : (*it)->base();
+                return false;
+            }
+            // 清理: 总大小超过 max_bytes, 或者最后一条消息早于 max_age 秒之前的分段(正在写的分段不清理)
+            // 总大小按分段文件预先分配的大小计算, 也就是实际占用的磁盘空间
+            void expire(size_t max_bytes, int max_age)
+            {
+                int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  std::chrono::system_clock::now().time_since_epoch())
+                                  .count();
+                std::unique_lock<std::mutex> lock(_mutex);
+                size_t total = 0;
+                for (auto &segment : _segments)
+                    total += segment->allocated();
+                while (_segments.size() > 1)
+                {
+                    auto &oldest = _segments.front();
+                    bool too_big = max_bytes > 0 && total > max_bytes;
+                    bool too_old = max_age > 0 && oldest->lastTime() < now - (int64_t)max_age * 1000;
+                    if (!too_big && !too_old)
+                        break;
+                    total -= oldest->allocated();
+                    oldest->remove();
+                    _segments.erase(_segments.begin());
+                }
+            }
+            // 把正在写的分段刷到磁盘, 保存有变化的消费位置
+            void sync()
+            {
+                LogSegment::ptr active;
+                std::map<std::string, uint64_t> offsets;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    active = _segments.back();
+                    if (_offsets_dirty)
+                        offsets = _offsets;
+                    _offsets_dirty = false;
+                }
+                active->sync();
+                if (offsets.empty() == false)
+                    saveOffsets(offsets);
+            }
+            // 消费者提交消费位置: seq 以及之前的消息都处理完了
+            void commit(const std::string &consumer, uint64_t seq)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _offsets[consumer] = seq;
+                _offsets_dirty = true;
+            }
+            bool committed(const std::string &consumer, uint64_t &seq)
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                auto it = _offsets.find(consumer);
+                if (it == _offsets.end())
+                    return false;
+                seq = it->second;
+                return true;
+            }
+            // 主题的元数据(名称和创建参数), 重启时用来重新创建主题
+            bool saveMeta(const std::string &meta)
+            {
+                FILE *fp = fopen((_dir + "/meta").c_str(), "w");
+                if (fp == nullptr)
+                    return false;
+                bool ret = fwrite(meta.data(), 1, meta.size(), fp) == meta.size();
+                fclose(fp);
+                return ret;
+            }
+            bool loadMeta(std::string &meta)
+            {
+                FILE *fp = fopen((_dir + "/meta").c_str(), "r");
+                if (fp == nullptr)
+                    return false;
+                char buf[1024];
+                size_t n = fread(buf, 1, sizeof(buf), fp);
+                fclose(fp);
+                meta.assign(buf, n);
+                return n > 0;
+            }
+            // 删除主题时删除它的所有文件
+            void destroy()
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                for (auto &segment : _segments)
+                    segment->remove();
+                ::unlink((_dir + "/offsets").c_str());
+                ::unlink((_dir + "/meta").c_str());
+                ::rmdir(_dir.c_str());
+            }
+
+        private:
+            // 调用者已加锁
+            bool roll(uint64_t base)
+            {
+                auto segment = std::make_shared<LogSegment>();
+                if (segment->open(_dir, base, _segment_size) == false)
+                    return false;
+                if (_segments.empty() == false)
+                    _segments.back()->sync();
+                _segments.push_back(segment);
+                return true;
+            }
+            // offsets 文件: 每行 "序号 消费者名称"
+            void loadOffsets()
+            {
+                FILE *fp = fopen((_dir + "/offsets").c_str(), "r");
+                if (fp == nullptr)
+                    return;
+                unsigned long long seq = 0;
+                char name[256];
+                while (fscanf(fp, "%llu %255[^\n]", &seq, name) == 2)
+                    _offsets[name] = seq;
+                fclose(fp);
+            }
+            void saveOffsets(const std::map<std::string, uint64_t> &offsets)
+            {
+                std::string path = _dir + "/offsets", tmp = path + ".tmp";
+                FILE *fp = fopen(tmp.c_str(), "w");
+                if (fp == nullptr)
+                {
+                    ERR_LOG("保存消费位置 %s 失败: %s", path.c_str(), strerror(errno));
+                    return;
+                }
+                for (auto &offset : offsets)
+                    fprintf(fp, "%llu %s\n", (unsigned long long)offset.second, offset.first.c_str());
+                fflush(fp);
+                ::fsync(fileno(fp));
+                fclose(fp);
+                ::rename(tmp.c_str(), path.c_str());
+            }
+
+        private:
+            std::mutex _mutex;
+            std::string _dir;
+            size_t _segment_size;
+            std::vector<LogSegment::ptr> _segments; // 按起始序号排列, 最后一个是正在写的
+            std::map<std::string, uint64_t> _offsets; // 消费者 -> 已提交的序号
+            bool _offsets_dirty;
+        };
+    }
+}
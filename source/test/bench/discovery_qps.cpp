@@ -0,0 +1,98 @@
+#include "../../server/rpc_server.hpp"
+#include "../../client/rpc_client.hpp"
+#include <atomic>
+#include <thread>
+
+// 服务发现吞吐测试: 分别启动开启 / 关闭响应缓存的两个注册中心，注册同样的提供者，
+// 多个线程各自用一条连接不停地发服务发现请求，比较每秒处理的请求数
+// ./discovery_qps [提供者个数] [并发连接数] [每轮测试秒数]
+using namespace TrRpc;
+
+// 直接向注册中心发服务发现请求(不经过 Discoverer 的缓存)
+class Prober
+{
+public:
+    Prober(int port)
+        : _requestor(std::make_shared<client::Requestor>()), _dispatcher(std::make_shared<Dispatcher>())
+    {
+        auto rsp_cb = std::bind(&client::Requestor::onResponse, _requestor.get(), std::placeholders::_1, std::placeholders::_2);
+        _dispatcher->registerHandler<BaseMessage>(MType::RSP_SERVICE, rsp_cb);
+        _client = ClientFactory::create("127.0.0.1", port);
+        _client->SetMessageCallback(std::bind(&Dispatcher::OnMessage, _dispatcher.get(), std::placeholders::_1, std::placeholders::_2));
+        _client->connect();
+    }
+    bool probe(const std::string &method)
+    {
+        auto req = MessageFactory::create<ServiceRequest>();
+        req->setId(UUid::uuid());
+        req->setMtype(MType::REQ_SERVICE);
+        req->setMethod(method);
+        req->setOptype(ServiceOptype::SERVICE_DISCOVERY);
+        BaseMessage::ptr rsp;
+        return _requestor->send(_client->connection(), req, rsp);
+    }
+
+private:
+    client::Requestor::ptr _requestor;
+    Dispatcher::ptr _dispatcher;
+    BaseClient::ptr _client;
+};
+
+double measure(int port, int threads, int seconds)
+{
+    std::atomic<bool> running(true);
+    std::atomic<long> count(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++)
+    {
+        workers.emplace_back([&, port]()
+                             {
+                                 Prober prober(port);
+                                 while (running)
+                                 {
+                                     if (prober.probe("Echo"))
+                                         count++;
+                                 } });
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+    for (auto &worker : workers)
+        worker.join();
+    return (double)count / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    int providers = argc > 1 ? std::stoi(argv[1]) : 50;
+    int threads = argc > 2 ? std::stoi(argv[2]) : 8;
+    int seconds = argc > 3 ? std::stoi(argv[3]) : 5;
+    const int ports[2] = {8610, 8611};
+
+    std::vector<client::RegistryClient::ptr> regs;
+    for (int i = 0; i < 2; i++)
+    {
+        int port = ports[i];
+        bool cache = i == 0;
+        std::thread reg_thread([port, cache]()
+                               {
+                                   server::RegistryServer server(port);
+                                   server.setThreadNum(4);
+                                   server.setDiscoveryCache(cache);
+                                   server.Start(); });
+        reg_thread.detach();
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        for (int p = 0; p < providers; p++)
+        {
+            auto reg = std::make_shared<client::RegistryClient>("127.0.0.1", port);
+            reg->serviceRegistry("Echo", Address("127.0.0.1", 10000 + p));
+            regs.push_back(reg);
+        }
+    }
+
+    double with_cache = measure(ports[0], threads, seconds);
+    double without_cache = measure(ports[1], threads, seconds);
+    std::cout << "providers=" << providers << " connections=" << threads << " seconds=" << seconds << std::endl;
+    std::cout << "discovery qps with cache:    " << with_cache << std::endl;
+    std::cout << "discovery qps without cache: " << without_cache << std::endl;
+    return 0;
+}
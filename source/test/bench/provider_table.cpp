@@ -0,0 +1,83 @@
+#include "../../server/rpc_registry.hpp"
+#include <fstream>
+#include <unistd.h>
+
+// 提供者表测试: 不经过网络，直接测量 ProviderManager 在大量 (提供者, 方法) 对下的内存占用和各操作耗时
+// ./provider_table [提供者个数] [每个提供者的方法数] [方法总数]
+using namespace TrRpc;
+
+// 只用来当作 map 的 key, 不会真的发送数据
+class NullConnection : public BaseConnection
+{
+public:
+    void send(const BaseMessage::ptr &) override {}
+    void shutdown() override {}
+    bool connected() override { return true; }
+};
+
+// 进程当前占用的物理内存(KB)
+static long rssKB()
+{
+    long pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static double since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    int providers = argc > 1 ? std::stoi(argv[1]) : 1000;
+    int per_provider = argc > 2 ? std::stoi(argv[2]) : 100;
+    int total_methods = argc > 3 ? std::stoi(argv[3]) : 1000;
+
+    std::vector<BaseConnection::ptr> conns;
+    std::vector<std::vector<std::string>> methods(providers);
+    for (int p = 0; p < providers; p++)
+    {
+        conns.push_back(std::make_shared<NullConnection>());
+        for (int m = 0; m < per_provider; m++)
+            methods[p].push_back("Service.method" + std::to_string((p * 7 + m) % total_methods));
+    }
+
+    server::ProviderManager manager;
+    long base_rss = rssKB();
+    auto start = std::chrono::steady_clock::now();
+    for (int p = 0; p < providers; p++)
+        manager.addProvider(conns[p], Address("10.0.0." + std::to_string(p % 250), 10000 + p), methods[p]);
+    double add_ms = since(start);
+    long table_kb = rssKB() - base_rss;
+
+    // 服务发现: 每个方法查一次提供者列表
+    start = std::chrono::steady_clock::now();
+    size_t hosts = 0;
+    for (int m = 0; m < total_methods; m++)
+        hosts += manager.methodHosts("Service.method" + std::to_string(m)).size();
+    double lookup_ms = since(start);
+
+    // 一半提供者下线再重新上线(模拟滚动重启)
+    start = std::chrono::steady_clock::now();
+    server::ProviderRecord removed;
+    for (int p = 0; p < providers; p += 2)
+        manager.delProvider(conns[p], removed);
+    double del_ms = since(start);
+    start = std::chrono::steady_clock::now();
+    for (int p = 0; p < providers; p += 2)
+        manager.addProvider(conns[p], Address("10.0.0." + std::to_string(p % 250), 10000 + p), methods[p]);
+    double readd_ms = since(start);
+
+    size_t pairs = (size_t)providers * per_provider;
+    std::cout << "providers=" << providers << " methods/provider=" << per_provider
+              << " methods=" << total_methods << " pairs=" << pairs << std::endl;
+    std::cout << "table memory: " << table_kb << "KB (" << table_kb * 1024.0 / pairs << " bytes/pair)" << std::endl;
+    std::cout << "add:    " << add_ms << "ms (" << add_ms * 1000 / pairs << " us/pair)" << std::endl;
+    std::cout << "lookup: " << lookup_ms << "ms (" << lookup_ms * 1000 / total_methods << " us/method, "
+              << hosts << " hosts)" << std::endl;
+    std::cout << "del:    " << del_ms << "ms (" << del_ms * 2000 / providers << " us/provider)" << std::endl;
+    std::cout << "re-add: " << readd_ms << "ms" << std::endl;
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "../../server/rpc_server.hpp"
+#include "../../client/rpc_client.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+// 注册中心抖动测试: 大量服务提供者反复下线 / 上线(模拟批量重启)的同时，测量注册中心处理服务发现请求的延迟
+// ./registry_churn [发现者个数] [提供者个数] [每个提供者的方法数] [重启轮数] [I/O 线程数]
+using namespace TrRpc;
+
+const int regPort = 8600;
+
+// 直接向注册中心发服务发现请求，测一次请求往返的耗时(不经过 Discoverer 的缓存)
+class Prober
+{
+public:
+    Prober()
+        : _requestor(std::make_shared<client::Requestor>()), _dispatcher(std::make_shared<Dispatcher>())
+    {
+        auto rsp_cb = std::bind(&client::Requestor::onResponse, _requestor.get(), std::placeholders::_1, std::placeholders::_2);
+        _dispatcher->registerHandler<BaseMessage>(MType::RSP_SERVICE, rsp_cb);
+        _client = ClientFactory::create("127.0.0.1", regPort);
+        _client->SetMessageCallback(std::bind(&Dispatcher::OnMessage, _dispatcher.get(), std::placeholders::_1, std::placeholders::_2));
+        _client->connect();
+    }
+    double probe(const std::string &method)
+    {
+        auto req = MessageFactory::create<ServiceRequest>();
+        req->setId(UUid::uuid());
+        req->setMtype(MType::REQ_SERVICE);
+        req->setMethod(method);
+        req->setOptype(ServiceOptype::SERVICE_DISCOVERY);
+        BaseMessage::ptr rsp;
+        auto start = std::chrono::steady_clock::now();
+        _requestor->send(_client->connection(), req, rsp);
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    client::Requestor::ptr _requestor;
+    Dispatcher::ptr _dispatcher;
+    BaseClient::ptr _client;
+};
+
+int main(int argc, char *argv[])
+{
+    int discoverers = argc > 1 ? std::stoi(argv[1]) : 200;
+    int providers = argc > 2 ? std::stoi(argv[2]) : 20;
+    int methods = argc > 3 ? std::stoi(argv[3]) : 50;
+    int rounds = argc > 4 ? std::stoi(argv[4]) : 5;
+    int threads = argc > 5 ? std::stoi(argv[5]) : 4;
+
+    std::thread reg_thread([threads]()
+                           {
+                               server::RegistryServer server(regPort);
+                               server.setThreadNum(threads);
+                               server.Start(); });
+    reg_thread.detach();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    // 发现者: 每个都关心所有方法
+    std::vector<client::DiscoveryClient::ptr> clients;
+    for (int i = 0; i < discoverers; i++)
+    {
+        auto client = std::make_shared<client::DiscoveryClient>("127.0.0.1", regPort, [](const Address &) {});
+        for (int m = 0; m < methods; m++)
+            client->serviceDiscovery("method" + std::to_string(m), [](bool, const Address &) {});
+        clients.push_back(client);
+    }
+
+    // 测量线程: 在抖动期间不停地发服务发现请求
+    std::atomic<bool> running(true);
+    std::vector<double> latency;
+    std::thread probe_thread([&]()
+                             {
+                                 Prober prober;
+                                 while (running)
+                                     latency.push_back(prober.probe("method0"));
+                             });
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+    {
+        std::vector<client::RegistryClient::ptr> regs;
+        for (int p = 0; p < providers; p++)
+        {
+            auto reg = std::make_shared<client::RegistryClient>("127.0.0.1", regPort);
+            for (int m = 0; m < methods; m++)
+                reg->serviceRegistry("method" + std::to_string(m), Address("127.0.0.1", 10000 + p));
+            regs.push_back(reg);
+        }
+        regs.clear(); // 全部断开: 批量下线
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    running = false;
+    probe_thread.join();
+
+    std::sort(latency.begin(), latency.end());
+    auto pct = [&](double p)
+    { return latency.empty() ? 0 : latency[std::min(latency.size() - 1, (size_t)(latency.size() * p))]; };
+    std::cout << "discoverers=" << discoverers << " providers=" << providers << " methods=" << methods
+              << " rounds=" << rounds << " io_threads=" << threads << std::endl;
+    std::cout << "churn time: " << elapsed << "s, probes: " << latency.size() << std::endl;
+    std::cout << "discovery latency(us) p50=" << pct(0.5) << " p99=" << pct(0.99) << " max=" << pct(1.0) << std::endl;
+    return 0;
+}
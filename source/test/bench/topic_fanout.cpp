@@ -0,0 +1,96 @@
+#include "../../server/rpc_server.hpp"
+#include "../../client/rpc_client.hpp"
+#include <muduo/net/EventLoopThreadPool.h>
+#include <muduo/net/TcpClient.h>
+#include <atomic>
+#include <thread>
+
+// 大主题推送测试: 一个主题有很多订阅者, 服务端开多个 I/O 线程
+// 测量 发布请求的平均耗时(发布者等待服务端确认) 和 每条消息推送给所有订阅者的总耗时
+// 订阅者直接用 muduo 的 TcpClient(几个 loop 上放很多连接), 只数收到的帧
+// ./topic_fanout [订阅者个数] [服务端 I/O 线程数] [发布消息数]   (订阅者很多时需要先调大 ulimit -n)
+using namespace TrRpc;
+
+static std::atomic<long> g_frames(0);
+
+// 从 LV 格式的数据中取出完整的帧计数(不解析内容)
+static void onSubscriberMessage(const muduo::net::TcpConnectionPtr &, muduo::net::Buffer *buf, muduo::Timestamp)
+{
+    while (buf->readableBytes() >= 4)
+    {
+        int32_t len = buf->peekInt32();
+        if (buf->readableBytes() < (size_t)len + 4)
+            break;
+        buf->retrieve(len + 4);
+        g_frames++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int subscribers = argc > 1 ? std::stoi(argv[1]) : 2000;
+    int server_threads = argc > 2 ? std::stoi(argv[2]) : 4;
+    int messages = argc > 3 ? std::stoi(argv[3]) : 200;
+    const int port = 8620;
+    const std::string key = "bench.fanout";
+
+    std::thread server_thread([=]()
+                              {
+                                  server::TopicServer server(port);
+                                  server.setThreadNum(server_threads);
+                                  server.setMaxQueue(messages + 16);
+                                  server.Start(); });
+    server_thread.detach();
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    auto publisher = std::make_shared<client::TopicClient>("127.0.0.1", port);
+    publisher->create(key);
+
+    // 订阅请求: 所有订阅者发同一份序列化好的帧
+    auto sub_req = MessageFactory::create<TopicRequest>();
+    sub_req->setId(UUid::uuid());
+    sub_req->setMtype(MType::REQ_TOPIC);
+    sub_req->setOptype(TopicOptype::TOPIC_SUBSCRIBE);
+    sub_req->setTopicKey(key);
+    std::string sub_frame = LVProtocolFactory::create()->serialize(sub_req);
+
+    muduo::net::EventLoop base_loop;
+    muduo::net::EventLoopThreadPool pool(&base_loop, "subscribers");
+    pool.setThreadNum(4);
+    pool.start();
+    std::vector<std::unique_ptr<muduo::net::TcpClient>> clients;
+    for (int i = 0; i < subscribers; i++)
+    {
+        std::unique_ptr<muduo::net::TcpClient> client(new muduo::net::TcpClient(pool.getNextLoop(), muduo::net::InetAddress("127.0.0.1", port), "sub"));
+        client->setConnectionCallback([sub_frame](const muduo::net::TcpConnectionPtr &conn)
+                                      {
+                                          if (conn->connected())
+                                              conn->send(sub_frame); });
+        client->setMessageCallback(onSubscriberMessage);
+        client->connect();
+        clients.push_back(std::move(client));
+    }
+    // 等所有订阅者都收到订阅响应
+    while (g_frames < subscribers)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    g_frames = 0;
+
+    printf("订阅者 %d 个, 服务端 I/O 线程 %d 个, 发布 %d 条\n", subscribers, server_threads, messages);
+    double publish_ms = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < messages; i++)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        publisher->publish(key, "message " + std::to_string(i));
+        publish_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+    long expect = (long)subscribers * messages;
+    while (g_frames < expect)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("发布平均耗时: %.3f ms\n", publish_ms / messages);
+    printf("全部推送完成: %.1f ms, 每条消息推送给所有订阅者 %.3f ms, %.0f 帧/秒\n",
+           total_ms, total_ms / messages, expect / total_ms * 1000);
+    publisher->shutdown();
+    _exit(0); // 订阅者的 TcpClient 在各自的 loop 中, 直接退出
+}
@@ -0,0 +1,80 @@
+#include "../../server/rpc_topic.hpp"
+#include <thread>
+
+// 主题发布并发测试: 不经过网络，多个线程同时调用 TopicManager::onTopicRequest 发布到各自的主题
+// 测量 1, 2, 4 ... 个发布线程时的总吞吐量, 观察发布到不相关主题时是否随线程数增长
+// ./topic_publish [主题个数] [每个主题的订阅者个数] [每个线程发布的消息数] [最大线程数]
+using namespace TrRpc;
+
+// 订阅者连接: 不是 muduo 连接, 推送时直接调用 send, 这里什么都不做
+class NullConnection : public BaseConnection
+{
+public:
+    void send(const BaseMessage::ptr &) override {}
+    void shutdown() override {}
+    bool connected() override { return true; }
+};
+
+static TopicRequest::ptr topicRequest(const std::string &key, TopicOptype optype)
+{
+    auto msg = MessageFactory::create<TopicRequest>();
+    msg->setId(UUid::uuid());
+    msg->setMtype(MType::REQ_TOPIC);
+    msg->setOptype(optype);
+    msg->setTopicKey(key);
+    return msg;
+}
+
+int main(int argc, char *argv[])
+{
+    int topics = argc > 1 ? std::stoi(argv[1]) : 1000;
+    int subscribers = argc > 2 ? std::stoi(argv[2]) : 4;
+    int per_thread = argc > 3 ? std::stoi(argv[3]) : 200000;
+    int max_threads = argc > 4 ? std::stoi(argv[4]) : (int)std::thread::hardware_concurrency();
+
+    server::TopicManager manager;
+    BaseConnection::ptr publisher = std::make_shared<NullConnection>();
+    std::vector<BaseConnection::ptr> conns;
+    for (int s = 0; s < subscribers; s++)
+        conns.push_back(std::make_shared<NullConnection>());
+    for (int t = 0; t < topics; t++)
+    {
+        std::string key = "bench.topic" + std::to_string(t);
+        manager.onTopicRequest(publisher, topicRequest(key, TopicOptype::TOPIC_CREATE));
+        for (auto &conn : conns)
+            manager.onTopicRequest(conn, topicRequest(key, TopicOptype::TOPIC_SUBSCRIBE));
+    }
+
+    printf("主题 %d 个, 每个主题 %d 个订阅者, 每个线程发布 %d 条\n", topics, subscribers, per_thread);
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        // 提前构造好请求: 只测量发布路径本身
+        std::vector<std::vector<TopicRequest::ptr>> requests(threads);
+        for (int i = 0; i < threads; i++)
+        {
+            for (int n = 0; n < per_thread; n++)
+            {
+                // 每个线程发布到不同的一组主题
+                int topic = (i * 7919 + n) % topics;
+                auto msg = topicRequest("bench.topic" + std::to_string(topic), TopicOptype::TOPIC_PUBLISH);
+                msg->setTopicMsg("hello");
+                msg->setAck(false);
+                requests[i].push_back(msg);
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; i++)
+        {
+            workers.emplace_back([&, i]()
+                                 {
+                                     for (auto &msg : requests[i])
+                                         manager.onTopicRequest(publisher, msg); });
+        }
+        for (auto &worker : workers)
+            worker.join();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("%2d 个发布线程: %.1f ms, %.0f 条/秒\n", threads, ms, (double)threads * per_thread / ms * 1000);
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include "../../client/rpc_client.hpp"
+
+// C++20 协程调用: 每个 co_await 等待一次 Rpc 调用, 等待期间不占用线程
+using namespace TrRpc::client;
+
+Task<int> add(RpcClient &client, int num1, int num2)
+{
+    Json::Value params;
+    params["num1"] = num1;
+    params["num2"] = num2;
+    Json::Value result = co_await client.callAsync("Add", params);
+    co_return result.asInt();
+}
+
+// 依赖前一次结果的连续调用, 写成顺序的代码
+Task<int> sum(RpcClient &client, int count)
+{
+    int total = 0;
+    for (int i = 1; i <= count; i++)
+        total = co_await add(client, total, i);
+    co_return total;
+}
+
+// 调用服务端没有注册的方法
+Task<void> notExist(RpcClient &client)
+{
+    Json::Value params;
+    params["num1"] = 1;
+    co_await client.callAsync("NotExist", params);
+}
+
+int main()
+{
+    RpcClient client(false, "127.0.0.1", 9090);
+    try
+    {
+        DBG_LOG("1 + 2 + ... + 10 = %d", syncWait(sum(client, 10)));
+        // 不存在的方法: co_await 抛出 RpcError
+        syncWait(notExist(client));
+    }
+    catch (const RpcError &e)
+    {
+        DBG_LOG("调用失败: %s", e.what());
+    }
+    return 0;
+}
@@ -39,6 +39,23 @@ int main()
     {
         DBG_LOG("异步获取result: %d", res_future.get().asInt());
     }
+    // 可以组合的 future: 同时发出多个调用, 全部完成后一起取结果
+    std::vector<TrRpc::client::RpcCaller::JsonFuture> futures;
+    for (int i = 0; i < 5; i++)
+    {
+        params["num1"] = i;
+        params["num2"] = i;
+        TrRpc::client::RpcCaller::JsonFuture future;
+        client->call("Add", params, future);
+        futures.push_back(std::move(future));
+    }
+    auto sum = TrRpc::client::whenAll(std::move(futures)).then([](std::vector<Json::Value> &results)
+                                                               {
+                                                                   int total = 0;
+                                                                   for (auto &result : results)
+                                                                       total += result.asInt();
+                                                                   return total; });
+    DBG_LOG("whenAll 结果之和: %d", sum.get());
     std::this_thread::sleep_for(std::chrono::seconds(2));
     return 0;
 }
\ No newline at end of file
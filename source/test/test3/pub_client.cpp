@@ -14,6 +14,16 @@ int main()
         std::string msg = "NBA" + std::to_string(i);
         client->publish("sport", msg);
     }
+    // 异步发布: 不等待确认就发下一条，最后等最后一条的确认
+    std::future<bool> last;
+    for(int i = 0; i < 100; i++)
+        client->publish("sport", "CBA" + std::to_string(i), last);
+    INF_LOG("异步发布 %s", last.get() ? "成功" : "失败");
+    // 不需要确认的发布
+    client->publishNoAck("sport", "WNBA");
+    // 二进制消息: 内容按原样传输
+    const char score[] = {0x00, 0x6e, 0x00, 0x63};
+    client->publishBinary("sport", score, sizeof(score));
     client->shutdown();
     return 0;
 }
\ No newline at end of file
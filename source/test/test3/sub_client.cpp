@@ -9,6 +9,8 @@ void callback(const std::string &key, const std::string &msg)
 int main()
 {
     auto client = std::make_shared<TrRpc::client::TopicClient>("127.0.0.1", 8085);
+    // 订阅回调在 2 个线程上执行(同一个主题按顺序), 不占用连接的 I/O 线程
+    client->setDeliveryThreads(2);
     // 不管是 subscribe 还是 publish 客户端都要先创建，避免不存在
     bool ret = client->create("sport");
     if (ret == false)
@@ -18,6 +20,8 @@ int main()
     client->subscribe("sport", callback);
     // 等待->退出
     std::this_thread::sleep_for(std::chrono::seconds(10));
+    auto stats = client->deliveryStats();
+    INF_LOG("回调执行了 %lu 条, 排队最多 %zu 条", (unsigned long)stats.executed, stats.max_pending);
     client->shutdown();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,26 @@
+#include "../../client/rpc_client.hpp"
+#include <atomic>
+#include <thread>
+
+// 消费组: 同时启动几个 worker_client, 同一条 sport 消息只会被其中一个处理
+// ./worker_client [组名]
+int main(int argc, char *argv[])
+{
+    std::string group = argc > 1 ? argv[1] : "workers";
+    auto client = std::make_shared<TrRpc::client::TopicClient>("127.0.0.1", 8085);
+    bool ret = client->create("sport");
+    if (ret == false)
+    {
+        ERR_LOG("创建主题失败");
+    }
+    std::atomic<int> handled(0); // 在客户端的 loop 线程中累加, 在主线程中读取
+    client->join("sport", group, [&handled](const std::string &key, const std::string &msg)
+                 {
+                     handled++;
+                     INF_LOG("消费组成员处理了 %s 主题的 %s 消息", key.c_str(), msg.c_str()); });
+    std::this_thread::sleep_for(std::chrono::seconds(10));
+    INF_LOG("本成员一共处理了 %d 条消息", handled.load());
+    client->leave("sport", group);
+    client->shutdown();
+    return 0;
+}
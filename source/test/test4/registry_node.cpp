@@ -0,0 +1,17 @@
+#include "../../server/rpc_server.hpp"
+
+// 注册中心集群中的一个节点: ./reg_node 本节点端口 其它节点端口...
+// 如: 三个节点分别运行 ./reg_node 8080 8081 8082;  ./reg_node 8081 8080 8082;  ./reg_node 8082 8080 8081
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cout << "usage: " << argv[0] << " port [peer_port...]" << std::endl;
+        return -1;
+    }
+    TrRpc::server::RegistryServer server(std::stoi(argv[1]));
+    for (int i = 2; i < argc; i++)
+        server.addPeer(TrRpc::Address("127.0.0.1", std::stoi(argv[i])));
+    server.Start();
+    return 0;
+}
@@ -0,0 +1,21 @@
+#include "../../client/rpc_client.hpp"
+#include <thread>
+
+// 调用者: 随机连接集群中的某个节点进行服务发现，不管服务提供者注册在哪个节点上都能发现
+int main()
+{
+    std::vector<TrRpc::Address> nodes = {TrRpc::Address("127.0.0.1", 8080),
+                                         TrRpc::Address("127.0.0.1", 8081),
+                                         TrRpc::Address("127.0.0.1", 8082)};
+    auto client = std::make_shared<TrRpc::client::RpcClient>(nodes);
+    for (int i = 0; i < 10; i++)
+    {
+        Json::Value params, result;
+        params["num1"] = i;
+        params["num2"] = i * 10;
+        if (client->call("Add", params, result))
+            DBG_LOG("result: %d", result.asInt());
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    return 0;
+}
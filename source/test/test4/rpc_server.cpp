@@ -0,0 +1,27 @@
+#include "../../server/rpc_server.hpp"
+
+void Add(const Json::Value &params, Json::Value &result)
+{
+    DBG_LOG("成功进入 Add 函数");
+    int sum = params["num1"].asInt() + params["num2"].asInt();
+    result = sum;
+}
+
+// 服务提供者: ./server 监听端口, 连接注册中心集群中的某个节点进行注册
+int main(int argc, char *argv[])
+{
+    int port = argc > 1 ? std::stoi(argv[1]) : 9090;
+    auto sd_factory = std::make_shared<TrRpc::server::SDescribeFactory>();
+    sd_factory->setMethodName("Add");
+    sd_factory->setParamsDesc("num1", TrRpc::server::VType::INTEGRAL);
+    sd_factory->setParamsDesc("num2", TrRpc::server::VType::INTEGRAL);
+    sd_factory->setReturnType(TrRpc::server::VType::INTEGRAL);
+    sd_factory->setCallback(Add);
+    std::vector<TrRpc::Address> nodes = {TrRpc::Address("127.0.0.1", 8080),
+                                         TrRpc::Address("127.0.0.1", 8081),
+                                         TrRpc::Address("127.0.0.1", 8082)};
+    TrRpc::server::RpcServer server(TrRpc::Address("127.0.0.1", port), nodes);
+    server.registerMethod(sd_factory->build());
+    server.start();
+    return 0;
+}